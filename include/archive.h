@@ -0,0 +1,30 @@
+/**
+ * @file: archive.h
+ * @brief: record/replay archive of HTTP responses for the findpng2 crawler.
+ *
+ * In record mode every response (URL, status, raw headers, body) is appended
+ * to a single file. In replay mode the file is mmap'ed read-only and indexed
+ * once, and lookups hand out pointers straight into the mapping, so a crawl
+ * can be rerun at memory speed without the network.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct archive_resp {
+    long status;          /* HTTP status, 0 if the transfer failed        */
+    const char *headers;  /* raw header block, NUL terminated             */
+    size_t hdr_len;       /* length of headers excluding the NUL          */
+    const char *body;     /* response body, NUL terminated                */
+    size_t body_len;      /* length of body excluding the NUL             */
+} archive_resp_t;
+
+int  archive_record_open(const char *path); //truncate path and start recording, 1 on success
+int  archive_record(const char *url, long status, const char *headers, size_t hdr_len,
+                    const char *body, size_t body_len); //append one response, thread safe
+void archive_record_close(void); //flush and close the record file
+
+int  archive_replay_open(const char *path); //mmap and index an archive, 1 on success
+int  archive_lookup(const char *url, archive_resp_t *out); //1 if url was recorded, pointers stay valid until close
+void archive_replay_close(void); //unmap the archive
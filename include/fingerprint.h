@@ -0,0 +1,20 @@
+/**
+ * @file: fingerprint.h
+ * @brief: page content fingerprints for the findpng2 crawler.
+ *
+ * fp_hash64 is XXH64, a fast non-cryptographic 64-bit hash. The fingerprint
+ * set is a process wide concurrent set of 64-bit values, split into shards
+ * with a lock each so parallel inserts rarely meet on the same lock.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t fp_hash64(const void *data, size_t len, uint64_t seed); //XXH64 of data
+
+int    fp_set_insert(uint64_t fp, size_t *grown); //1 if fp is new, 0 if already present; *grown gets bytes newly allocated
+void   fp_set_clear(void); //forget every fingerprint, keeping the memory
+void   fp_set_destroy(void); //free the set
+size_t fp_set_bytes(void); //memory held by the set
@@ -0,0 +1,58 @@
+/**
+ * @file: frontier.h
+ * @brief: compact LIFO store of URLs for the findpng2 crawl frontier.
+ *
+ * URLs are kept as records in fixed size blocks instead of one allocation
+ * each. A record names the scheme and interned host (see hosts.h) and
+ * front-codes the rest of the URL against the record before it: only the
+ * length of the shared prefix and the differing suffix are stored. Every
+ * FRONTIER_RESTART_INTERVAL records a restart point stores the path in
+ * full, so popping the newest URL decodes at most one short run.
+ *
+ * Whole blocks are the unit of spilling to disk. Host ids are only valid in
+ * the process that wrote them, so spilled blocks must be read back by the
+ * same process.
+ *
+ * A frontier is not thread safe; callers lock around it.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define FRONTIER_URL_MAX 2048          /* longest URL a record holds, excluding the NUL */
+#define FRONTIER_BLOCK_SIZE 4096
+#define FRONTIER_RESTART_INTERVAL 16
+#define FRONTIER_MAX_RESTARTS 64
+
+typedef struct frontier_block {
+    unsigned short used;          /* bytes of data in use               */
+    unsigned short count;         /* records in the block               */
+    unsigned short num_restarts;
+    unsigned short restarts[FRONTIER_MAX_RESTARTS];  /* offsets of full records */
+    unsigned char data[FRONTIER_BLOCK_SIZE - 3 * sizeof(unsigned short) -
+                       FRONTIER_MAX_RESTARTS * sizeof(unsigned short)];
+} frontier_block_t;
+
+typedef struct frontier {
+    frontier_block_t **blocks;    /* oldest first                                */
+    unsigned num_blocks;
+    unsigned capacity;
+    frontier_block_t *spare;      /* emptied block kept for the next push        */
+    unsigned long count;          /* URLs held                                   */
+    unsigned long long url_bytes; /* what the URLs would take as C strings       */
+    char tail[FRONTIER_URL_MAX];  /* path of the newest record, if tail_valid    */
+    size_t tail_len;
+    int tail_valid;
+    unsigned tail_run;            /* records since the newest restart point      */
+} frontier_t;
+
+void   frontier_init(frontier_t *f); //empty frontier, allocates nothing yet
+void   frontier_destroy(frontier_t *f); //free every block
+int    frontier_push(frontier_t *f, const char *url); //copy url in as the newest entry, 1 on success
+size_t frontier_pop(frontier_t *f, char *buf, size_t size); //newest URL into buf, its length, 0 when empty
+size_t frontier_memory(const frontier_t *f); //bytes held by blocks and the block table
+
+unsigned long frontier_write_oldest(frontier_t *f, FILE *fp, unsigned n); //move the n oldest blocks to fp, URLs moved
+long   frontier_read_block(frontier_t *f, FILE *fp); //append the block at fp's position as newest, URLs read, 0 at EOF, -1 on error
@@ -0,0 +1,30 @@
+/**
+ * @file: hosts.h
+ * @brief: host table for the findpng2 crawler.
+ *
+ * Every host (the lowercased authority of a URL, e.g. "example.com:8080") is
+ * interned once and from then on named by a small integer id. Per host the
+ * table keeps a latency histogram with log-scale buckets (four per
+ * doubling, so quantiles are accurate to about 20%) and failure counters.
+ * Recording and reading statistics take no lock; only interning a new host
+ * does.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define HOST_NONE ((unsigned)-1)
+
+unsigned    host_intern(const char *url); //id of url's host, created on first use; HOST_NONE if url has no host
+unsigned    host_intern_n(const char *host, size_t len); //same for a host already split out of a URL
+const char *host_key(unsigned id); //interned host string
+unsigned    hosts_count(void); //ids are 0 .. hosts_count() - 1
+size_t      hosts_memory(void); //bytes held by the table, it only grows
+
+void     host_record_latency(unsigned id, unsigned long long us); //a successful fetch took us microseconds
+unsigned host_record_failure(unsigned id); //a fetch failed, returns consecutive failures so far
+long     host_latency_quantile_ms(unsigned id, double q, unsigned long min_samples); //-1 with fewer than min_samples
+unsigned long host_samples(unsigned id); //successful fetches recorded
+
+void hosts_destroy(void); //free the table, ids become invalid
@@ -0,0 +1,29 @@
+/**
+ * @file: http_cache.h
+ * @brief: on-disk HTTP revalidation cache for the findpng2 crawler.
+ *
+ * Entries are content-addressed by a hash of the canonical URL and keep
+ * the validators (ETag / Last-Modified), the content type and the outlinks
+ * extracted from the page, so a later crawl can send a conditional request
+ * and reuse the links on a 304 without downloading or parsing the page.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define CACHE_VALUE_MAX 256  /* max length of a stored header value */
+
+typedef struct cache_entry {
+    char etag[CACHE_VALUE_MAX];          /* ETag validator, "" if none          */
+    char last_modified[CACHE_VALUE_MAX]; /* Last-Modified validator, "" if none */
+    int  content_type;                   /* caller defined content type code    */
+    char **links;                        /* absolute outlinks of the page       */
+    unsigned num_links;                  /* number of entries in links          */
+} cache_entry_t;
+
+int  cache_open(const char *dir); //create (if needed) and select the cache directory, 1 on success
+int  cache_canonical_url(const char *url, char *out, size_t out_len); //lowercase scheme/host, drop default port and fragment
+int  cache_load(const char *url, cache_entry_t *out); //1 on hit, 0 on miss; caller frees with cache_entry_free
+int  cache_store(const char *url, const cache_entry_t *in); //atomically replace the entry for url, 1 on success
+void cache_entry_free(cache_entry_t *e); //free the link array of an entry loaded by cache_load
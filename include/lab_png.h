@@ -12,6 +12,8 @@
  * INCLUDE HEADER FILES
  *****************************************************************************/
 #include <stdio.h>
+#include <stddef.h>
+#include <zlib.h>
 
 /******************************************************************************
  * DEFINED MACROS 
@@ -23,6 +25,8 @@
 #define CHUNK_TYPE_SIZE 4 /* chunk type field size in bytes */
 #define CHUNK_CRC_SIZE  4 /* chunk CRC field size in bytes */
 #define DATA_IHDR_SIZE 13 /* IHDR chunk data field size */
+#define PNG_IDAT_CHUNK (64 * 1024) /* data bytes per IDAT from png_writer */
+#define PNG_DIM_MAX 0x7fffffffU   /* largest width or height a PNG may have */
 
 /******************************************************************************
  * STRUCTURES and TYPEDEFS 
@@ -60,6 +64,44 @@ typedef struct simple_PNG {
     struct chunk *p_IEND;
 } *simple_PNG_p;
 
+/* A read-only view of a whole PNG: a mapping of a file or a caller's buffer */
+typedef struct png_view {
+    const U8 *data;
+    size_t len;
+    int mapped;        /* data is an mmap of a file, undone by png_view_close */
+} png_view_t;
+
+/* One chunk as it sits in a view, nothing is copied */
+typedef struct png_chunk_ref {
+    U32 length;        /* length of data, host byte order */
+    const U8 *type;    /* 4 bytes */
+    const U8 *data;    /* length bytes */
+    U32 crc;           /* stored CRC, host byte order */
+} png_chunk_ref_t;
+
+/* Walks the chunks of a view in file order */
+typedef struct png_chunk_iter {
+    const U8 *pos;
+    const U8 *end;
+    int truncated;     /* set when a chunk ran past the end of the view */
+} png_chunk_iter_t;
+
+/* Writes a PNG as its rows come in: the filtered rows are deflated as they
+   are appended and each PNG_IDAT_CHUNK bytes of output go out as one IDAT,
+   so memory use does not grow with the image. With threads, blocks of rows
+   are deflated on a pool of workers and joined in order */
+typedef struct png_writer {
+    FILE *out;
+    z_stream zs;       /* deflate without threads; next_out/avail_out track buf always */
+    struct png_def_pool *pool;
+    U8 *buf;           /* the IDAT being filled */
+    int ok;            /* cleared by the first deflate or write error */
+    long ihdr_pos;     /* file offset of the IHDR, for png_writer_set_height */
+    struct data_IHDR hdr;
+} png_writer_t;
+
+struct mem_ctx;        /* reusable zlib stream, see zutil.h */
+
 /******************************************************************************
  * FUNCTION PROTOTYPES 
  *****************************************************************************/
@@ -87,5 +129,26 @@ void free_chunk(chunk_p in); //free the memory of a struct chunk and inner data
 int write_PNG(char* filepath, simple_PNG_p in); //write a struct simple_PNG to file
 int write_chunk(FILE* fp, chunk_p in); //write a struct chunk to file
   
-int save_png_from_memstrips(const unsigned char *data[], const size_t sizes[], const char *filename); // Reusing from some part of catpng.c
+int png_view_open(png_view_t *v, const char *path); //map a file read-only, 1 on success
+void png_view_mem(png_view_t *v, const U8 *buf, size_t len); //view a buffer the caller keeps alive
+void png_view_close(png_view_t *v); //unmap a file view
+int png_chunk_iter_init(png_chunk_iter_t *it, const png_view_t *v); //1 if the view starts with a PNG signature
+int png_chunk_next(png_chunk_iter_t *it, png_chunk_ref_t *out); //1 with the next chunk, 0 at the end of the data
+int png_chunk_is(const png_chunk_ref_t *c, const char *type); //1 if the chunk has the 4 letter type
+U32 png_chunk_calc_crc(const png_chunk_ref_t *c); //CRC of type and data, computed in place
+int png_view_IHDR(struct data_IHDR *out, const png_view_t *v); //decode the leading IHDR, 1 on success
+int png_view_inflate(const png_view_t *v, U8 *dest, size_t *dest_len); //inflate all IDATs into dest of *dest_len bytes, Z_OK on success
+int png_view_inflate_ctx(struct mem_ctx *ctx, const png_view_t *v, U8 *dest, size_t *dest_len); //png_view_inflate reusing an inflate stream from mem_inf_init
+
+int png_writer_begin(png_writer_t *w, FILE *out, const struct data_IHDR *hdr, const png_chunk_ref_t *plte, int level, int threads); //write signature, IHDR and PLTE (color type 3 only), 1 on success
+int png_writer_append(png_writer_t *w, const U8 *rows, size_t len); //deflate more filtered rows, 1 on success
+int png_writer_set_height(png_writer_t *w, U32 height); //rewrite the IHDR once the height is known, out must be seekable
+int png_writer_finish(png_writer_t *w); //flush the last IDAT, write IEND and free the writer, 1 if everything was written
+
+size_t png_raw_size(const struct data_IHDR *hdr); //exact bytes of filtered scanlines, 0 if interlaced, invalid or too large for memory
+int png_stitch(const png_view_t views[], const char *const names[], int n, FILE *out, int threads, int join); //stack compatible PNGs into one on out, splicing their deflate streams if join; number stitched or -1 on error
+    //names, when not NULL, label the warnings about skipped views; threads inflate the strips and deflate the result
+int png_stitch_files(const char *const paths[], int n, FILE *out, int threads); //png_stitch as a pipeline over files read as they are needed, out must be seekable
+
+int save_png_from_memstrips(const unsigned char *data[], const size_t sizes[], const char *filename, int join); // Reusing from some part of catpng.c
 /* you're free to design and declare your own functions prototypes here*/
@@ -0,0 +1,31 @@
+/**
+ * @file: mpmc_queue.h
+ * @brief: bounded lock-free multi-producer multi-consumer queue of pointers.
+ *
+ * Array based with a sequence number per cell (Vyukov's design): a push or
+ * pop is one CAS on the shared position plus one store to the cell, and
+ * producers and consumers only contend with their own kind. The queue never
+ * blocks; callers decide how to wait when it is full or empty.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct mpmc_cell {
+    atomic_size_t seq;
+    void *item;
+} mpmc_cell_t;
+
+typedef struct mpmc_queue {
+    mpmc_cell_t *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t enqueue_pos;  /* own cache lines, producers */
+    _Alignas(64) atomic_size_t dequeue_pos;  /* and consumers do not share */
+} mpmc_queue_t;
+
+int   mpmc_init(mpmc_queue_t *q, size_t capacity); //capacity is rounded up to a power of two, 1 on success
+void  mpmc_destroy(mpmc_queue_t *q); //free the cells, items are the caller's
+int   mpmc_push(mpmc_queue_t *q, void *item); //1 on success, 0 when full
+void *mpmc_pop(mpmc_queue_t *q); //oldest item, NULL when empty
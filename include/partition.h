@@ -0,0 +1,50 @@
+/**
+ * @file: partition.h
+ * @brief: host-hash partitioning and the message transport between the
+ *         findpng2 coordinator and its worker processes.
+ *
+ * Every host belongs to exactly one of N partitions. Workers and the
+ * coordinator exchange newline terminated text messages over a stream
+ * socket; nothing here depends on the peer being a local process, so the
+ * same protocol can run over TCP between machines.
+ *
+ * Messages (one letter, a space, a payload):
+ *   U <url>    worker -> coordinator: URL owned by another partition
+ *              coordinator -> worker: URL owned by the receiving worker
+ *   P <url>    worker -> coordinator: PNG found
+ *   I <n>      worker -> coordinator: idle after receiving n URLs in total
+ *   Q          coordinator -> worker: stop crawling
+ *
+ * Neither side may block writing to the other while the other blocks
+ * writing back, so messages are queued in a part_outbuf_t: the coordinator
+ * flushes each worker's buffer as poll reports room for it, a worker's
+ * sender thread flushes its buffer with blocking writes.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define PART_LINE_MAX 4096  /* longest message including kind and newline */
+
+typedef struct part_reader {
+    int fd;
+    char buf[PART_LINE_MAX * 2];
+    size_t len;
+} part_reader_t;
+
+typedef struct part_outbuf {
+    char *data;
+    size_t len;       /* bytes queued                  */
+    size_t cap;
+} part_outbuf_t;
+
+unsigned partition_of(const char *url, unsigned nparts); //partition owning the host of url
+int  part_send(int fd, pthread_mutex_t *lock, char kind, const char *payload); //write one message, 1 on success
+void part_reader_init(part_reader_t *r, int fd); //attach a line reader to a socket
+int  part_reader_fill(part_reader_t *r); //read what is available, 0 on EOF or error
+int  part_reader_next(part_reader_t *r, char *kind, char *payload, size_t payload_len); //pop one buffered message, 1 if any
+int  part_outbuf_put(part_outbuf_t *b, char kind, const char *payload); //queue one message, 1 on success
+int  part_outbuf_flush(part_outbuf_t *b, int fd, int block); //write queued bytes, all of them if block, else what fits now; 0 on error
+void part_outbuf_free(part_outbuf_t *b); //drop the queue and its memory
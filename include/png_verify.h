@@ -0,0 +1,39 @@
+/**
+ * @file: png_verify.h
+ * @brief: streaming PNG structure check for findpng2 --verify.
+ *
+ * Bytes are fed in whatever pieces they arrive in. The verifier walks the
+ * signature and every chunk's length, type and CRC, checks chunk order
+ * (IHDR first, PLTE before IDAT for palette images, IDATs consecutive,
+ * IEND last) and inflates the IDAT data as it goes, discarding the output
+ * but counting it against the size the IHDR implies. Nothing is buffered
+ * beyond this struct and the inflate window.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <zlib.h>
+
+typedef struct png_verify {
+    int state;
+    unsigned long pos;              /* bytes of the current field seen      */
+    unsigned long length;           /* data length of the current chunk     */
+    unsigned long stored_crc;       /* CRC field as read so far             */
+    unsigned long crc;              /* running CRC of type and data         */
+    unsigned char type[4];
+    unsigned char ihdr[13];
+    int seen_ihdr, seen_plte, seen_idat;
+    int in_idat;                    /* the previous chunk was an IDAT       */
+    unsigned long long raw_expected;/* filtered image bytes the IHDR implies */
+    unsigned long long raw_seen;    /* bytes inflated so far                */
+    z_stream zs;
+    int z_end;                      /* the zlib stream is complete          */
+    const char *error;              /* why the image was rejected, or NULL  */
+} png_verify_t;
+
+int  png_verify_init(png_verify_t *v); //1 on success
+void png_verify_reset(png_verify_t *v); //start over on a new image
+void png_verify_destroy(png_verify_t *v); //free the inflate state
+int  png_verify_feed(png_verify_t *v, const void *data, size_t n); //0 once the image is known to be invalid
+int  png_verify_finish(png_verify_t *v); //1 if everything fed was one complete, valid PNG
@@ -0,0 +1,48 @@
+/**
+ * @file: scope.h
+ * @brief: crawl scope rules for findpng2, compiled into byte tries.
+ *
+ * Rules are domain suffixes to allow or deny, path prefixes to allow or
+ * deny, file extensions to exclude and a maximum path depth. Domain rules
+ * go into a trie of reversed host suffixes matched on label boundaries, so
+ * "example.com" covers "www.example.com" but not "badexample.com"; path
+ * rules go into a trie of prefixes and extensions into a trie of reversed
+ * suffixes. Checking a URL is one walk over each, without allocating.
+ *
+ * For domains and paths the most specific matching rule wins; with no
+ * match, a URL is in scope unless allow rules of that kind exist.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct scope_node {
+    unsigned char c;
+    signed char verdict;          /* 1 allow, -1 deny, 0 no rule ends here */
+    unsigned first_child;         /* index into nodes, 0 for none          */
+    unsigned next_sibling;
+} scope_node_t;
+
+typedef struct scope_trie {
+    scope_node_t *nodes;          /* nodes[0] is the root */
+    unsigned count;
+    unsigned capacity;
+    int has_allow;                /* default to deny when unmatched */
+} scope_trie_t;
+
+typedef struct scope {
+    scope_trie_t hosts;           /* reversed domain suffixes */
+    scope_trie_t paths;           /* path prefixes            */
+    scope_trie_t exts;            /* reversed ".ext" suffixes */
+    unsigned max_depth;           /* path segments, 0 for no limit */
+    int active;
+} scope_t;
+
+void scope_init(scope_t *s); //no rules, everything in scope
+void scope_destroy(scope_t *s); //free the tries
+int  scope_add_domain(scope_t *s, const char *suffix, int allow); //1 on success
+int  scope_add_path(scope_t *s, const char *prefix, int allow); //1 on success
+int  scope_add_ext(scope_t *s, const char *ext); //exclude paths ending in .ext, 1 on success
+void scope_set_max_depth(scope_t *s, unsigned depth); //0 for no limit
+int  scope_allows(const scope_t *s, const char *url, size_t len); //1 if the absolute http(s) URL is in scope
@@ -0,0 +1,56 @@
+/**
+ * @file: uring_http.h
+ * @brief: minimal HTTP/1.1 GET client on io_uring for plain http:// crawls.
+ *
+ * A client owns one ring and a fixed number of request slots. Each slot has
+ * a receive buffer registered with the ring and a request buffer, takes
+ * kept alive connections from a shared pool, and runs connect -> send ->
+ * receive as ring operations, each linked to a timeout. Responses are
+ * parsed in place: the header block and body handed back point into the
+ * slot buffer and stay valid until the slot is recycled.
+ *
+ * Anything the client does not handle (https, redirects, chunked bodies,
+ * responses larger than a slot buffer) completes as UHTTP_FALLBACK so the
+ * caller can retry it with a general purpose client.
+ *
+ * Host names are looked up on a resolver thread of the client's own, so a
+ * slow DNS answer delays only the requests waiting for it; a host that
+ * does not resolve completes as UHTTP_FALLBACK.
+ *
+ * A client is not thread safe; use one per thread.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+enum { UHTTP_OK, UHTTP_FALLBACK, UHTTP_ERROR };
+
+typedef struct uhttp uhttp_t;
+
+typedef struct uhttp_result {
+    int outcome;          /* UHTTP_OK, UHTTP_FALLBACK or UHTTP_ERROR            */
+    long status;          /* HTTP status code                                   */
+    const char *headers;  /* status line and header lines, in the slot buffer   */
+    size_t hdr_len;
+    const char *body;     /* response body, NUL terminated, in the slot buffer  */
+    size_t body_len;
+    void *user;           /* pointer passed to uhttp_submit                     */
+    unsigned slot;        /* hand back with uhttp_recycle when done             */
+} uhttp_result_t;
+
+typedef struct uhttp_stats {
+    unsigned long requests;    /* requests sent                                 */
+    unsigned long connects;    /* new connections opened                        */
+    unsigned long reused;      /* requests sent on a kept alive connection      */
+    unsigned long fallbacks;   /* completions handed back as UHTTP_FALLBACK     */
+} uhttp_stats_t;
+
+uhttp_t *uhttp_create(unsigned slots, size_t buf_size); //ring with slots buffers of buf_size bytes, NULL if io_uring is unavailable
+void uhttp_destroy(uhttp_t *c); //close connections and the ring
+int  uhttp_supports(const char *url); //1 if url is plain http the client can fetch
+int  uhttp_submit(uhttp_t *c, const char *url, const char *extra_headers, long connect_ms, long timeout_ms,
+                  void *user); //start a GET with per-operation timeouts, 0 if unsupported or no slot is free
+int  uhttp_wait(uhttp_t *c, uhttp_result_t *out, int timeout_ms); //1 with a finished request, 0 on timeout, -1 on error
+void uhttp_recycle(uhttp_t *c, unsigned slot); //release a finished slot for the next request
+void uhttp_get_stats(const uhttp_t *c, uhttp_stats_t *out); //counters since create
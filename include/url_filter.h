@@ -0,0 +1,39 @@
+/**
+ * @file: url_filter.h
+ * @brief: compact visited-URL filter for very large findpng2 crawls.
+ *
+ * The first tier is a blocked Bloom filter: each URL sets and tests its bits
+ * within one 64-byte block, so a lookup touches a single cache line and
+ * takes no lock; adds set the bits under one of a set of locks striped over
+ * the blocks, so a URL is claimed once. It is sized from the expected number
+ * of URLs and a false positive budget, a few bytes per URL.
+ *
+ * The optional second tier is an exact set of 64-bit URL fingerprints in a
+ * memory mapped temporary file, consulted only when the Bloom filter
+ * answers "maybe". Its pages belong to the kernel's page cache rather than
+ * the heap, so they can be written back and evicted under memory pressure.
+ * With it, URLs are never wrongly reported as seen except on a fingerprint
+ * collision. Once a part of it fills up, the URLs it cannot record fall back
+ * to the Bloom filter's answer.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct url_filter url_filter_t;
+
+typedef struct url_filter_stats {
+    unsigned long long added;            /* URLs claimed                                  */
+    unsigned long long false_positives;  /* Bloom "maybe" answers the exact tier refuted  */
+    unsigned long long overflowed;       /* URLs left to the Bloom filter, exact tier full */
+    size_t filter_bytes;                 /* Bloom filter, in memory                       */
+    size_t table_bytes;                  /* exact tier, file backed                       */
+    unsigned hashes;                     /* bits set per URL                              */
+} url_filter_stats_t;
+
+url_filter_t *url_filter_create(unsigned long long expected, double fp_rate, int exact_tier); //NULL on failure
+void url_filter_destroy(url_filter_t *f); //unmap and free everything
+int  url_filter_add(url_filter_t *f, const char *url); //1 if url is new and now recorded, 0 if (probably) seen
+int  url_filter_contains(url_filter_t *f, const char *url); //1 if url was (probably) added before
+void url_filter_get_stats(const url_filter_t *f, url_filter_stats_t *out); //sizes and counters
@@ -27,12 +27,29 @@
 #endif
 
 #define CHUNK 16384  /* =256*64 on the order of 128K or 256K should be used */
+#define PAR_DEF_BLOCK (128 * 1024)  /* input bytes per block of a parallel deflate */
 
 /* TYPEDEFS */
 typedef unsigned char U8;
 typedef unsigned long int U64;
 
+/* a zlib stream kept from one buffer to the next, reset rather than set up
+   again for each; it must stay where it was set up */
+typedef struct mem_ctx {
+    z_stream strm;
+    int deflate;      /* 1 for deflate, 0 for inflate */
+} mem_ctx_t;
+
 /* FUNCTION PROTOTYPES */
 int mem_def(U8 *dest, U64 *dest_len, U8 *source,  U64 source_len, int level);
+int mem_def_block(mem_ctx_t *ctx, U8 *dest, U64 *dest_len, const U8 *dict, U64 dict_len,
+                  const U8 *source, U64 source_len, int last);
+void mem_def_header(U8 *dest, int level);
 int mem_inf(U8 *dest, U64 *dest_len, U8 *source,  U64 source_len);
+int mem_def_init(mem_ctx_t *ctx, int level, int raw);
+int mem_inf_init(mem_ctx_t *ctx, int raw);
+void mem_ctx_end(mem_ctx_t *ctx);
+U64 mem_def_bound(U64 source_len);
+int mem_def_ctx(mem_ctx_t *ctx, U8 *dest, U64 *dest_len, const U8 *source, U64 source_len);
+int mem_inf_ctx(mem_ctx_t *ctx, U8 *dest, U64 *dest_len, const U8 *source, U64 source_len);
 void zerr(int ret);
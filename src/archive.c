@@ -0,0 +1,208 @@
+/**
+ * @file: archive.c
+ * @brief: record/replay archive of HTTP responses, see archive.h
+ *
+ * File layout (host byte order, the archive is a local profiling artifact):
+ *   "FPARCH01"
+ *   records, each 8-byte aligned:
+ *     U32 url_len, U32 hdr_len, U64 body_len, I64 status
+ *     url '\0' headers '\0' body '\0' padding
+ * The trailing NULs let replayed bodies be parsed in place as C strings.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+#define ARCHIVE_MAGIC     "FPARCH01"
+#define ARCHIVE_MAGIC_LEN 8
+#define ARCHIVE_ALIGN     8
+
+typedef struct {
+    uint32_t url_len;
+    uint32_t hdr_len;
+    uint64_t body_len;
+    int64_t  status;
+} rec_hdr_t;
+
+// Record side
+static FILE *rec_fp = NULL;
+static pthread_mutex_t rec_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Replay side: the mapping plus an open addressing index of record offsets
+static const char *map_base = NULL;
+static size_t map_len = 0;
+static size_t *index_slots = NULL;  // record offset + 1, 0 marks an empty slot
+static size_t index_mask = 0;
+
+static uint64_t hash_url(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static size_t record_size(const rec_hdr_t *rh) {
+    size_t n = sizeof(*rh) + rh->url_len + 1 + rh->hdr_len + 1 + rh->body_len + 1;
+    return (n + ARCHIVE_ALIGN - 1) & ~(size_t)(ARCHIVE_ALIGN - 1);
+}
+
+int archive_record_open(const char *path) {
+    rec_fp = fopen(path, "wb");
+    if (!rec_fp) {
+        perror("archive_record_open: fopen");
+        return 0;
+    }
+    if (fwrite(ARCHIVE_MAGIC, 1, ARCHIVE_MAGIC_LEN, rec_fp) != ARCHIVE_MAGIC_LEN) {
+        fclose(rec_fp);
+        rec_fp = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int archive_record(const char *url, long status, const char *headers, size_t hdr_len,
+                   const char *body, size_t body_len) {
+    if (!rec_fp || !url) return 0;
+
+    rec_hdr_t rh = {
+        .url_len = (uint32_t)strlen(url),
+        .hdr_len = headers ? (uint32_t)hdr_len : 0,
+        .body_len = body ? body_len : 0,
+        .status = status
+    };
+    static const char zeros[ARCHIVE_ALIGN] = {0};
+    size_t pad = record_size(&rh) - (sizeof(rh) + rh.url_len + rh.hdr_len + rh.body_len + 3);
+
+    pthread_mutex_lock(&rec_mutex);
+    fwrite(&rh, sizeof(rh), 1, rec_fp);
+    fwrite(url, 1, rh.url_len + 1, rec_fp);
+    if (rh.hdr_len) fwrite(headers, 1, rh.hdr_len, rec_fp);
+    fwrite(zeros, 1, 1, rec_fp);
+    if (rh.body_len) fwrite(body, 1, rh.body_len, rec_fp);
+    fwrite(zeros, 1, 1 + pad, rec_fp);
+    int ok = !ferror(rec_fp);
+    pthread_mutex_unlock(&rec_mutex);
+    return ok;
+}
+
+void archive_record_close(void) {
+    if (rec_fp) {
+        fclose(rec_fp);
+        rec_fp = NULL;
+    }
+}
+
+// Insert a record offset into the index; a later record for the same URL wins
+static void index_insert(size_t off) {
+    const rec_hdr_t *rh = (const rec_hdr_t *)(map_base + off);
+    const char *url = map_base + off + sizeof(*rh);
+    size_t i = hash_url(url, rh->url_len) & index_mask;
+    while (index_slots[i]) {
+        const rec_hdr_t *other = (const rec_hdr_t *)(map_base + index_slots[i] - 1);
+        if (other->url_len == rh->url_len &&
+            memcmp(map_base + index_slots[i] - 1 + sizeof(*other), url, rh->url_len) == 0) {
+            break;
+        }
+        i = (i + 1) & index_mask;
+    }
+    index_slots[i] = off + 1;
+}
+
+int archive_replay_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("archive_replay_open: open");
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < ARCHIVE_MAGIC_LEN) {
+        fprintf(stderr, "archive_replay_open: %s is not an archive\n", path);
+        close(fd);
+        return 0;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("archive_replay_open: mmap");
+        return 0;
+    }
+    map_base = base;
+    map_len = st.st_size;
+    if (memcmp(map_base, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "archive_replay_open: %s is not an archive\n", path);
+        archive_replay_close();
+        return 0;
+    }
+
+    // First pass counts records so the index can be sized once
+    size_t count = 0;
+    size_t off = ARCHIVE_MAGIC_LEN;
+    while (off + sizeof(rec_hdr_t) <= map_len) {
+        const rec_hdr_t *rh = (const rec_hdr_t *)(map_base + off);
+        if (rh->body_len > map_len) break;  // garbage header
+        size_t n = record_size(rh);
+        if (n > map_len - off) break;  // truncated tail, e.g. interrupted recording
+        count++;
+        off += n;
+    }
+
+    size_t slots = 16;
+    while (slots < count * 2) slots <<= 1;
+    index_slots = calloc(slots, sizeof(size_t));
+    if (!index_slots) {
+        archive_replay_close();
+        return 0;
+    }
+    index_mask = slots - 1;
+
+    off = ARCHIVE_MAGIC_LEN;
+    for (size_t i = 0; i < count; i++) {
+        index_insert(off);
+        off += record_size((const rec_hdr_t *)(map_base + off));
+    }
+    madvise((void *)map_base, map_len, MADV_WILLNEED);
+    return 1;
+}
+
+int archive_lookup(const char *url, archive_resp_t *out) {
+    if (!index_slots || !url || !out) return 0;
+    size_t len = strlen(url);
+    size_t i = hash_url(url, len) & index_mask;
+    while (index_slots[i]) {
+        const char *rec = map_base + index_slots[i] - 1;
+        const rec_hdr_t *rh = (const rec_hdr_t *)rec;
+        const char *rec_url = rec + sizeof(*rh);
+        if (rh->url_len == len && memcmp(rec_url, url, len) == 0) {
+            out->status = (long)rh->status;
+            out->headers = rec_url + rh->url_len + 1;
+            out->hdr_len = rh->hdr_len;
+            out->body = out->headers + rh->hdr_len + 1;
+            out->body_len = rh->body_len;
+            return 1;
+        }
+        i = (i + 1) & index_mask;
+    }
+    return 0;
+}
+
+void archive_replay_close(void) {
+    free(index_slots);
+    index_slots = NULL;
+    if (map_base) {
+        munmap((void *)map_base, map_len);
+        map_base = NULL;
+        map_len = 0;
+    }
+}
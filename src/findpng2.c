@@ -1,6 +1,9 @@
+#define _GNU_SOURCE  // nanosleep
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 #include <curl/curl.h>
 #include <unistd.h>
@@ -8,17 +11,109 @@
 #include <sys/time.h>
 #include <ctype.h>
 #include <search.h>  // For hash table functions
+#include <time.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <semaphore.h>
+#include <sched.h>
+#include "http_cache.h"
+#include "archive.h"
+#include "partition.h"
+#include "uring_http.h"
+#include "mpmc_queue.h"
+#include "fingerprint.h"
+#include "hosts.h"
+#include "frontier.h"
+#include "url_filter.h"
+#include "scope.h"
+#include "png_verify.h"
 
 // Constants
 #define URL_MAX_LEN 2048
 #define PNG_SIG_LEN 8
-#define INITIAL_LIST_CAPACITY 10000
 #define HASH_TABLE_SIZE 100000  // Large hash table for better performance
+#define LINK_LIST_CAPACITY 64   // Initial capacity of a per-page outlink list
+#define POP_BATCH_MAX 8         // Max URLs a worker takes from the frontier at once
+#define RESP_KEEP_CAPACITY 65536  // Response buffers above this are shrunk after each fetch
+#define SPILL_RELOAD_BATCH 256  // URLs read back from the spill file at a time, in whole blocks
+#define PARSE_QUEUE_CAPACITY 1024  // Fetched pages waiting for a parser
+#define TIMEOUT_MIN_SAMPLES 20  // Fetches from a host before its own timeout is derived
+#define TIMEOUT_P99_FACTOR 4    // Timeout = this many times the host's p99 latency
+#define TIMEOUT_FLOOR_MS 1000   // Derived timeouts never go below this
+#define RETRY_BASE_MS 250       // Backoff before the first retry, doubled for each one after
+#define HOST_FAILURE_LIMIT 8    // Consecutive failures after which a host gets no more retries
 static const unsigned char PNG_SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
 
 // Content types
 enum ContentType { CONTENT_UNKNOWN, CONTENT_HTML, CONTENT_PNG };
 
+// Memory buffer for curl
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} mem_t;
+
+// Response metadata collected by header_cb
+typedef struct {
+    int content_type;
+    char etag[CACHE_VALUE_MAX];
+    char last_modified[CACHE_VALUE_MAX];
+    int keep_raw;  // also keep the raw header block (record mode)
+    mem_t raw;
+    long hop_status;  // status of the header block being parsed
+    mem_t locations;  // Location of every redirect, NUL separated
+} resp_hdr_t;
+
+// Outcome of one fetch, body points into the response buffer or the replay archive
+typedef struct {
+    int ok;           // transfer completed
+    long status;      // HTTP status code
+    const char *body;
+    size_t body_len;
+    const char *effective_url;  // URL after redirects as reported by curl, NULL if unknown
+} fetch_result_t;
+
+// One fetch in progress: the URL plus the buffers and handle that carry it
+// from request to processed response
+typedef struct {
+    CURL *curl;
+    char *url;
+    mem_t resp;
+    resp_hdr_t hdr;
+    cache_entry_t cached;
+    int have_cached;
+    struct curl_slist *cond_headers;
+    unsigned host;                  // interned host of url
+    unsigned attempt;               // 0 for the first try, n for the n-th retry
+    unsigned long long start_ns;    // when the request was started
+    png_verify_t verify;            // --verify state of a PNG response
+    int verify_fed;                 // the body went to verify as it arrived
+} fetch_task_t;
+
+// A failed fetch waiting for its backoff to run out
+typedef struct {
+    unsigned long long due_ns;      // now_ns() time the retry may start
+    char *url;
+    unsigned attempt;
+} retry_t;
+
+// A fetched HTML page on its way to a parser thread
+typedef struct {
+    char *url;
+    char *base_url;  // final URL after redirects, NULL when not redirected
+    char *body;
+    size_t body_len;
+    size_t charged;  // bytes of body owned and charged by the job, 0 when borrowed
+    resp_hdr_t hdr;  // for the cache entry, raw is unused
+} parse_job_t;
+
 // URL List structure (dynamic array)
 typedef struct {
     char **urls;
@@ -28,87 +123,534 @@ typedef struct {
 
 // Global variables
 int T = 1;              // Number of threads
+unsigned num_tasks = 1; // Concurrent fetches per thread (--tasks)
+int use_uring = 0;      // Fetch plain http through io_uring (--uring)
+uhttp_stats_t uring_stats;  // Summed over threads, guarded by count_mutex
 int M = 50;             // Max PNGs to find
 char *start_url = NULL; // Seed URL
 char *log_file = NULL;  // Log file name (optional)
+char *cache_dir = NULL; // HTTP revalidation cache directory (optional)
+char *record_file = NULL; // Archive to record responses into (optional)
+char *replay_file = NULL; // Archive to serve responses from (optional)
+long replay_latency_ms = 0; // Simulated per-fetch latency in replay mode
+long fetch_timeout_ms = 10000;  // Timeout of a fetch until its host has a latency history (--timeout)
+long connect_timeout_ms = 3000; // Connect timeout (--connect-timeout)
+unsigned max_retries = 2;       // Retries of a failed fetch (--retries)
+int verify_pngs = 0;    // Count only structurally valid PNGs (--verify)
 FILE *log_fp = NULL;    // Log file pointer
 FILE *png_urls_fp = NULL; // PNG URLs file pointer
 volatile int png_count = 0;    // Total PNGs found
 volatile int should_exit = 0;  // Flag to signal threads to exit
 volatile int active_threads = 0; // Track active threads
+int idle_threads = 0;          // Workers waiting on an empty frontier, guarded by frontier_mutex
 pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t frontier_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t visited_mutex = PTHREAD_MUTEX_INITIALIZER;  // Separate mutex for visited URLs
 pthread_cond_t frontier_not_empty = PTHREAD_COND_INITIALIZER;
 
-// URL Lists
-url_list_t frontier_list = { .urls = NULL, .count = 0, .capacity = 0 };
+// Frontier of URLs to fetch, a LIFO of front-coded blocks
+frontier_t frontier;
+
+// Memory budget (--mem-limit). Frontier, visited set, host table and
+// response buffers charge mem_used; the in-memory frontier is held to a quarter of the budget
+// and its oldest blocks are spilled to disk beyond that.
+size_t mem_limit = 0;              // 0 = unlimited
+atomic_size_t mem_used = 0;
+atomic_size_t mem_peak = 0;
+size_t frontier_bytes = 0;         // in-memory frontier size, guarded by frontier_mutex
+size_t hosts_bytes = 0;            // host table size charged so far, guarded by frontier_mutex
+unsigned long long frontier_peak_url_bytes = 0;  // most URL string bytes held in memory at once
+size_t frontier_peak = 0;          // frontier_bytes at that point
+FILE *spill_fp = NULL;             // spilled frontier entries, guarded by frontier_mutex
+off_t spill_read_off = 0;
+off_t spill_write_off = 0;
+unsigned long spill_pending = 0;   // URLs in the spill file not yet reloaded
+unsigned long spill_total = 0;     // URLs ever spilled
+
+// Multi-process crawl (--procs). Each worker process owns the hosts that hash
+// to its partition and talks to the coordinator over part_fd.
+unsigned num_procs = 1;
+int part_index = -1;               // this worker's partition, -1 when not partitioned
+int part_fd = -1;
+// A worker's messages to the coordinator are queued here and written by
+// part_sender_thread, so no crawl thread blocks on the socket. The lock is
+// a leaf: it may be taken under frontier_mutex and count_mutex.
+part_outbuf_t part_out;
+int part_out_closed = 0;
+pthread_mutex_t part_out_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t part_out_ready = PTHREAD_COND_INITIALIZER;
+unsigned long part_recv_count = 0;     // URLs received from the coordinator, guarded by frontier_mutex
+unsigned long part_idle_reported = ULONG_MAX;
+
+// Daemon mode (--daemon). Curl's DNS and TLS session caches live in a share
+// object that outlives the jobs. Connection caches cannot be shared between
+// threads, so they stay warm by parking the easy and multi handles that hold
+// them between jobs instead of freeing them.
+typedef struct {
+    void **handles;
+    size_t count, cap;
+} handle_pool_t;
+
+CURLSH *curl_share = NULL;
+pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+int keep_handles = 0;              // park curl handles for the next job
+handle_pool_t warm_easy, warm_multi;
+pthread_mutex_t warm_mutex = PTHREAD_MUTEX_INITIALIZER;
+int keep_visited = 0;              // keep the exact visited table across jobs
+int job_fd = -1;                   // client socket of the running job, -1 outside a job
+pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;  // one writer on job_fd at a time
+
+// Parse stage (--parsers). Fetchers hand HTML pages to a pool of parser
+// threads; parse_pending counts pages not yet turned into frontier pushes so
+// the end-of-crawl check waits for them.
+unsigned num_parsers = 0;
+mpmc_queue_t parse_queue;
+sem_t parse_ready;                 // posted once per queued job, and per parser at shutdown
+volatile int parse_stop = 0;
+unsigned long parse_pending = 0;   // guarded by frontier_mutex
+unsigned long parse_pending_peak = 0;
+atomic_ulong stat_handed_off = 0;  // pages fetchers queued for parsing
+atomic_ullong stat_handoff_ns = 0; // time fetchers waited on a full parse queue
+atomic_ulong stat_parsed = 0;
+atomic_ullong stat_parse_ns = 0;   // time parsers spent extracting and queueing links
+atomic_ulong stat_links = 0;
+
+// Duplicate page detection (--dedup)
+int dedup = 0;
+atomic_ulong stat_pages_hashed = 0;
+atomic_ulong stat_duplicates = 0;
+atomic_ullong stat_duplicate_bytes = 0;
+
+// Redirects (fetches whose final URL differs from the requested one)
+atomic_ulong stat_redirected = 0;
+atomic_ulong stat_aliases = 0;     // of those, ending at an already claimed URL
+
+// Retries, a min-heap on due time guarded by frontier_mutex. Workers take due
+// retries before frontier URLs and idle workers sleep until the next is due.
+retry_t *retry_heap = NULL;
+unsigned retry_count = 0;
+unsigned retry_capacity = 0;
+atomic_ulong stat_retries = 0;
+atomic_ulong stat_failed = 0;      // fetches given up on
+atomic_ulong stat_png_rejected = 0;  // PNG responses --verify found invalid
+
+// Visited set representation (--visited-mode). Exact keeps every URL in the
+// hsearch table; bloom and tiered keep a url_filter sized for expected_urls.
+enum { VISITED_EXACT, VISITED_BLOOM, VISITED_TIERED };
+int visited_mode = VISITED_EXACT;
+unsigned long long expected_urls = 1000000;
+double visited_fp_rate = 0.001;
+url_filter_t *visited_filter = NULL;
+
+// Crawl scope (--allow-domain and friends), links outside it are dropped
+// when a page is parsed, before they take any memory
+scope_t crawl_scope;
+atomic_ulong stat_out_of_scope = 0;
+
+// Visited keys, so the table can be emptied between daemon jobs
+url_list_t visited_keys = { .urls = NULL, .count = 0, .capacity = 0 };
+size_t visited_bytes = 0;
+// Entries of the exact table hold the generation that claimed them. A daemon
+// job with --keep-visited starts a new one: the table and its keys stay, but
+// URLs claimed by earlier jobs count as unvisited and are claimed again.
+unsigned long visited_generation = 1;
 
 // Hash table for visited URLs
 static int hash_table_initialized = 0;
 
-// Memory buffer for curl
-typedef struct {
-    char *data;
-    size_t len;
-    size_t capacity;
-} mem_t;
+// Visited filter size and accuracy on stderr, per worker process in a partitioned crawl
+void report_visited(void) {
+    if (!visited_filter) return;
+    url_filter_stats_t st;
+    url_filter_get_stats(visited_filter, &st);
+    char who[32] = "";
+    if (part_index >= 0) snprintf(who, sizeof(who), " worker %d", part_index);
+    fprintf(stderr, "findpng2%s: visited filter holds %llu URLs in %zu bytes (%.1f bits/URL at capacity, "
+            "%u hashes)", who, st.added, st.filter_bytes, 8.0 * st.filter_bytes / expected_urls, st.hashes);
+    if (visited_mode == VISITED_TIERED) {
+        fprintf(stderr, ", %zu bytes file backed, %llu false positives resolved, %llu unrecorded\n",
+                st.table_bytes, st.false_positives, st.overflowed);
+    } else {
+        fprintf(stderr, ", up to %.2g%% of new URLs skipped as false positives\n", 100 * visited_fp_rate);
+    }
+}
+
+// Retry and failure counts on stderr, per worker process in a partitioned crawl
+void report_retries(void) {
+    unsigned long retries = atomic_load(&stat_retries);
+    unsigned long failed = atomic_load(&stat_failed);
+    if (retries == 0 && failed == 0) return;
+    char who[32] = "";
+    if (part_index >= 0) snprintf(who, sizeof(who), " worker %d", part_index);
+    fprintf(stderr, "findpng2%s: %lu fetches retried, %lu given up on\n", who, retries, failed);
+}
+
+// Links dropped by the scope rules on stderr, per worker process in a partitioned crawl
+void report_scope(void) {
+    if (!crawl_scope.active) return;
+    char who[32] = "";
+    if (part_index >= 0) snprintf(who, sizeof(who), " worker %d", part_index);
+    fprintf(stderr, "findpng2%s: %lu links out of scope\n", who, atomic_load(&stat_out_of_scope));
+}
+
+// PNGs rejected by --verify on stderr, per worker process in a partitioned crawl
+void report_verify(void) {
+    if (!verify_pngs) return;
+    char who[32] = "";
+    if (part_index >= 0) snprintf(who, sizeof(who), " worker %d", part_index);
+    fprintf(stderr, "findpng2%s: %lu PNGs rejected as invalid\n", who, atomic_load(&stat_png_rejected));
+}
+
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-// Initialize URL list
-void queue_init(url_list_t *list, int capacity) {
-    list->capacity = capacity;
-    list->urls = calloc(capacity, sizeof(char *));
-    if (!list->urls) {
-        perror("calloc url list");
-        exit(1);
+// Memory accounting
+void mem_charge(size_t n) {
+    size_t used = atomic_fetch_add(&mem_used, n) + n;
+    size_t peak = atomic_load(&mem_peak);
+    while (used > peak && !atomic_compare_exchange_weak(&mem_peak, &peak, used)) {
     }
-    list->count = 0;
 }
 
-void queue_push(url_list_t *list, char *url) {
-    if (!url) return;
-    pthread_mutex_lock(&frontier_mutex);
-    if (should_exit) {
-        pthread_mutex_unlock(&frontier_mutex);
-        free(url);
+void mem_release(size_t n) {
+    atomic_fetch_sub(&mem_used, n);
+}
+
+int mem_over_budget(void) {
+    return mem_limit && atomic_load(&mem_used) > mem_limit;
+}
+
+// Parse a size such as 512K, 64M or 2G
+size_t parse_size(const char *arg) {
+    char *end = NULL;
+    unsigned long long v = strtoull(arg, &end, 10);
+    switch (end ? toupper((unsigned char)*end) : 0) {
+        case 'G': v <<= 30; break;
+        case 'M': v <<= 20; break;
+        case 'K': v <<= 10; break;
+        default: break;
+    }
+    return (size_t)v;
+}
+
+// Charge or release the change in frontier memory since the last call, and
+// charge the host table, which grows as queued URLs intern their hosts.
+// Called with frontier_mutex held.
+void frontier_account(void) {
+    size_t held = hosts_memory();
+    if (held > hosts_bytes) {
+        mem_charge(held - hosts_bytes);
+        hosts_bytes = held;
+    }
+    size_t now = frontier_memory(&frontier);
+    if (now > frontier_bytes) {
+        mem_charge(now - frontier_bytes);
+    } else {
+        mem_release(frontier_bytes - now);
+    }
+    frontier_bytes = now;
+    if (frontier.url_bytes > frontier_peak_url_bytes) {
+        frontier_peak_url_bytes = frontier.url_bytes;
+        frontier_peak = now;
+    }
+}
+
+// Move the oldest half of the in-memory frontier blocks to the spill file.
+// Called with frontier_mutex held.
+void frontier_spill(void) {
+    if (!spill_fp) {
+        spill_fp = tmpfile();
+        if (!spill_fp) {
+            perror("tmpfile spill");
+            return;
+        }
+    }
+    unsigned n = frontier.num_blocks / 2;
+    if (n == 0) return;
+    if (fseeko(spill_fp, spill_write_off, SEEK_SET) != 0) return;
+    unsigned long urls = frontier_write_oldest(&frontier, spill_fp, n);
+    if (urls == 0) {
+        // Short write: the blocks stay in memory and the next spill
+        // overwrites whatever part of them reached the file
+        clearerr(spill_fp);
+        return;
+    }
+    spill_write_off = ftello(spill_fp);
+    spill_pending += urls;
+    spill_total += urls;
+    frontier_account();
+}
+
+// Read back spilled blocks holding about SPILL_RELOAD_BATCH URLs. Called
+// with frontier_mutex held on an empty frontier.
+void frontier_reload(void) {
+    if (!spill_fp || fseeko(spill_fp, spill_read_off, SEEK_SET) != 0) {
+        // Never leave spill_pending set without progress, or the poppers spin
+        fprintf(stderr, "frontier_reload: cannot seek the spill file, %lu URLs lost\n", spill_pending);
+        spill_pending = 0;
         return;
     }
+    while (spill_pending > 0 && frontier.count < SPILL_RELOAD_BATCH) {
+        long n = frontier_read_block(&frontier, spill_fp);
+        if (n <= 0) {
+            fprintf(stderr, "frontier_reload: spill file unreadable, %lu URLs lost\n", spill_pending);
+            spill_pending = 0;
+            break;
+        }
+        spill_pending -= (unsigned long)n < spill_pending ? (unsigned long)n : spill_pending;
+    }
+    spill_read_off = ftello(spill_fp);
+    frontier_account();
+}
+
+// Append to a thread-local list, no locking
+int list_append(url_list_t *list, char *url) {
     if (list->count >= list->capacity) {
-        unsigned new_capacity = list->capacity * 2;
+        unsigned new_capacity = list->capacity ? list->capacity * 2 : LINK_LIST_CAPACITY;
         char **new_urls = realloc(list->urls, new_capacity * sizeof(char *));
         if (!new_urls) {
-            fprintf(stderr, "queue_push: realloc failed, capacity=%u\n", new_capacity);
-            pthread_mutex_unlock(&frontier_mutex);
-            free(url);
-            return;
+            return 0;
         }
         list->urls = new_urls;
         list->capacity = new_capacity;
     }
     list->urls[list->count++] = url;
-    pthread_cond_signal(&frontier_not_empty);
-    pthread_mutex_unlock(&frontier_mutex);
+    return 1;
 }
 
-// Fixed queue_pop function
-char *queue_pop(url_list_t *list) {
+// Push all URLs in one critical section with a single wakeup. The frontier
+// keeps its own encoded copy, urls stay the caller's.
+void queue_push_many(frontier_t *f, char **urls, unsigned n) {
+    if (n == 0) return;
     pthread_mutex_lock(&frontier_mutex);
-    while (list->count == 0 && !should_exit) {
-        pthread_cond_wait(&frontier_not_empty, &frontier_mutex);
-    }
     if (should_exit) {
         pthread_mutex_unlock(&frontier_mutex);
-        return NULL;
+        return;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        if (!frontier_push(f, urls[i])) {
+            fprintf(stderr, "queue_push_many: cannot queue %.64s\n", urls[i]);
+        }
+    }
+    frontier_account();
+    // Backpressure: past its share or the global budget the frontier goes to disk
+    if (mem_limit && (frontier_bytes > mem_limit / 4 || mem_over_budget())) {
+        frontier_spill();
+    }
+    if (idle_threads > 0) {
+        if (n == 1) {
+            pthread_cond_signal(&frontier_not_empty);
+        } else {
+            pthread_cond_broadcast(&frontier_not_empty);
+        }
+    }
+    pthread_mutex_unlock(&frontier_mutex);
+}
+
+// Queue url (taken over) for another try after a jittered exponential backoff
+void retry_schedule(char *url, unsigned attempt) {
+    unsigned long long now = now_ns();
+    unsigned long long delay = (unsigned long long)RETRY_BASE_MS * 1000000ULL << (attempt - 1);
+    // Spread retries over [0.5, 1.5) of the delay so failures of one host do not return in step
+    uint64_t r = fp_hash64(url, strlen(url), now);
+    delay = delay / 2 + (unsigned long long)((double)(r >> 11) / (1ULL << 53) * delay);
+
+    pthread_mutex_lock(&frontier_mutex);
+    if (retry_count == retry_capacity) {
+        unsigned capacity = retry_capacity ? retry_capacity * 2 : 64;
+        retry_t *heap = realloc(retry_heap, capacity * sizeof(retry_t));
+        if (!heap) {
+            pthread_mutex_unlock(&frontier_mutex);
+            fprintf(stderr, "realloc failed for retry queue\n");
+            free(url);
+            atomic_fetch_add(&stat_failed, 1);
+            return;
+        }
+        retry_heap = heap;
+        retry_capacity = capacity;
+    }
+    unsigned i = retry_count++;
+    retry_t item = { now + delay, url, attempt };
+    while (i > 0 && retry_heap[(i - 1) / 2].due_ns > item.due_ns) {
+        retry_heap[i] = retry_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    retry_heap[i] = item;
+    atomic_fetch_add(&stat_retries, 1);
+    // Waiters sleep until the earliest due time, which may just have moved up
+    if (idle_threads > 0) {
+        pthread_cond_broadcast(&frontier_not_empty);
+    }
+    pthread_mutex_unlock(&frontier_mutex);
+}
+
+// Remove the earliest retry from the heap. Called with frontier_mutex held.
+retry_t retry_pop(void) {
+    retry_t top = retry_heap[0];
+    retry_t last = retry_heap[--retry_count];
+    unsigned i = 0;
+    for (;;) {
+        unsigned c = 2 * i + 1;
+        if (c >= retry_count) break;
+        if (c + 1 < retry_count && retry_heap[c + 1].due_ns < retry_heap[c].due_ns) c++;
+        if (retry_heap[c].due_ns >= last.due_ns) break;
+        retry_heap[i] = retry_heap[c];
+        i = c;
+    }
+    if (retry_count > 0) retry_heap[i] = last;
+    return top;
+}
+
+// Drop retries left over when a crawl ends
+void retry_clear(void) {
+    pthread_mutex_lock(&frontier_mutex);
+    while (retry_count > 0) {
+        free(retry_pop().url);
+    }
+    free(retry_heap);
+    retry_heap = NULL;
+    retry_capacity = 0;
+    pthread_mutex_unlock(&frontier_mutex);
+}
+
+// Sleep on frontier_not_empty until the earliest retry is due. Called with
+// frontier_mutex held and at least one retry queued.
+void retry_wait(void) {
+    unsigned long long now = now_ns();
+    if (retry_heap[0].due_ns <= now) return;
+    // The condition variable waits on the realtime clock
+    unsigned long long left = retry_heap[0].due_ns - now;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += left / 1000000000ULL;
+    deadline.tv_nsec += left % 1000000000ULL;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&frontier_not_empty, &frontier_mutex, &deadline);
+}
+
+// Queue a message for the coordinator; never blocks on the socket
+void part_post(char kind, const char *payload) {
+    pthread_mutex_lock(&part_out_mutex);
+    if (!part_out_closed && part_outbuf_put(&part_out, kind, payload)) {
+        pthread_cond_signal(&part_out_ready);
+    }
+    pthread_mutex_unlock(&part_out_mutex);
+}
+
+// Worker side: write queued messages to the coordinator in order. Once the
+// queue is closed, flushes what is left and ends.
+void *part_sender_thread(void *arg) {
+    (void)arg;
+    part_outbuf_t out = {0};  // swapped with part_out, written without the lock
+    pthread_mutex_lock(&part_out_mutex);
+    for (;;) {
+        while (part_out.len == 0 && !part_out_closed) {
+            pthread_cond_wait(&part_out_ready, &part_out_mutex);
+        }
+        if (part_out.len == 0) break;
+        part_outbuf_t t = out;
+        out = part_out;
+        part_out = t;
+        pthread_mutex_unlock(&part_out_mutex);
+        part_outbuf_flush(&out, part_fd, 1);  // on error the coordinator is gone, drop it
+        out.len = 0;
+        pthread_mutex_lock(&part_out_mutex);
+    }
+    pthread_mutex_unlock(&part_out_mutex);
+    part_outbuf_free(&out);
+    return NULL;
+}
+
+// Tell the coordinator this worker has run dry. Called with frontier_mutex
+// held.
+void part_report_idle(void) {
+    if (part_index < 0 || idle_threads != T || frontier.count > 0 || spill_pending > 0 ||
+        parse_pending > 0 || retry_count > 0 || part_idle_reported == part_recv_count) {
+        return;
+    }
+    unsigned long n = part_recv_count;
+    part_idle_reported = n;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lu", n);
+    part_post('I', buf);
+}
+
+// Pop up to max URLs into out, due retries first and then the frontier
+// newest first; attempts[i] gets the retry number of out[i], 0 for a frontier
+// URL. With wait set, blocks while there is nothing to hand out and returns 0
+// once the crawl is over, i.e. should_exit is set or every worker is waiting
+// here with nothing left to push or retry (single process only, partitioned
+// workers wait for the coordinator's verdict instead). Without wait, returns
+// 0 right away when nothing is ready.
+unsigned queue_pop_many(frontier_t *f, char **out, unsigned *attempts, unsigned max, int wait) {
+    pthread_mutex_lock(&frontier_mutex);
+    for (;;) {
+        unsigned n = 0;
+        unsigned long long now = retry_count > 0 ? now_ns() : 0;
+        while (n < max && retry_count > 0 && retry_heap[0].due_ns <= now && !should_exit) {
+            retry_t r = retry_pop();
+            out[n] = r.url;
+            attempts[n++] = r.attempt;
+        }
+        if (n > 0) {
+            pthread_mutex_unlock(&frontier_mutex);
+            return n;
+        }
+        if (f->count > 0 || should_exit) {
+            break;
+        }
+        if (spill_pending > 0) {
+            frontier_reload();
+            continue;
+        }
+        if (!wait) {
+            break;
+        }
+        idle_threads++;
+        if (idle_threads == T && part_index < 0 && parse_pending == 0 && retry_count == 0) {
+            should_exit = 1;
+            pthread_cond_broadcast(&frontier_not_empty);
+        } else {
+            // A partitioned worker may still get URLs from the coordinator
+            part_report_idle();
+            if (f->count == 0 && !should_exit) {
+                if (retry_count > 0) {
+                    retry_wait();
+                } else {
+                    pthread_cond_wait(&frontier_not_empty, &frontier_mutex);
+                }
+            }
+        }
+        idle_threads--;
     }
-    if (list->count == 0) {
+    if (should_exit || f->count == 0) {
         pthread_mutex_unlock(&frontier_mutex);
-        return NULL;
+        return 0;
     }
-    char *url = list->urls[--list->count];
-    list->urls[list->count] = NULL;
+    // Leave some work for the other workers when the frontier is short
+    unsigned long want = f->count / T;
+    if (want < 1) want = 1;
+    if (want > max) want = max;
+    unsigned n = 0;
+    char url[FRONTIER_URL_MAX + 1];
+    for (unsigned long i = 0; i < want; i++) {
+        size_t len = frontier_pop(f, url, sizeof(url));
+        char *copy = len ? malloc(len + 1) : NULL;
+        if (!copy) continue;
+        memcpy(copy, url, len + 1);
+        out[n] = copy;
+        attempts[n++] = 0;
+    }
+    frontier_account();
     pthread_mutex_unlock(&frontier_mutex);
-    return url;
+    return n;
 }
 
 void queue_destroy(url_list_t *list) {
@@ -128,6 +670,19 @@ void queue_destroy(url_list_t *list) {
 // Hash table functions for visited URLs
 int init_visited_hash_table() {
     if (hash_table_initialized) return 1;
+    if (visited_mode != VISITED_EXACT) {
+        visited_filter = url_filter_create(expected_urls, visited_fp_rate, visited_mode == VISITED_TIERED);
+        if (!visited_filter) {
+            fprintf(stderr, "url_filter_create failed for %llu URLs\n", expected_urls);
+            return 0;
+        }
+        url_filter_stats_t st;
+        url_filter_get_stats(visited_filter, &st);
+        visited_bytes = st.filter_bytes;  // the exact tier is file backed, not charged
+        mem_charge(visited_bytes);
+        hash_table_initialized = 1;
+        return 1;
+    }
     if (hcreate(HASH_TABLE_SIZE) == 0) {
         perror("hcreate");
         return 0;
@@ -138,6 +693,7 @@ int init_visited_hash_table() {
 
 int is_url_visited(const char *url) {
     if (!hash_table_initialized) return 0;
+    if (visited_filter) return url_filter_contains(visited_filter, url);
     
     ENTRY item;
     item.key = (char *)url;
@@ -145,42 +701,69 @@ int is_url_visited(const char *url) {
     
     pthread_mutex_lock(&visited_mutex);
     ENTRY *found = hsearch(item, FIND);
+    int visited = found && found->data == (void *)visited_generation;
     pthread_mutex_unlock(&visited_mutex);
     
-    return found != NULL;
+    return visited;
 }
 
+// Claim url in the visited set: 1 if this call added it, 0 if it was there
+// already, -1 on failure. Checking and adding under one lock means two
+// threads can never both claim the same URL.
 int add_to_visited(const char *url) {
-    if (!hash_table_initialized) return 0;
+    if (!hash_table_initialized) return -1;
+    if (visited_filter) return url_filter_add(visited_filter, url);
     
     // Create a copy of the URL for the hash table
     char *url_copy = malloc(strlen(url) + 1);
     if (!url_copy) {
         fprintf(stderr, "add_to_visited: malloc failed for url copy\n");
-        return 0;
+        return -1;
     }
     strcpy(url_copy, url);
     
     ENTRY item;
     item.key = url_copy;
-    item.data = (void *)1;  // Just a marker
+    item.data = (void *)visited_generation;
     
+    size_t charged = strlen(url_copy) + 1 + sizeof(ENTRY);
     pthread_mutex_lock(&visited_mutex);
     ENTRY *result = hsearch(item, ENTER);
+    int added = result && result->key == url_copy;
+    int reclaimed = 0;
+    if (added) {
+        // Untracked, the key stays referenced by the table and only leaks at exit
+        (void)list_append(&visited_keys, url_copy);
+        visited_bytes += charged;
+    } else if (result && result->data != (void *)visited_generation) {
+        result->data = (void *)visited_generation;  // an earlier job's, claim it for this one
+        reclaimed = 1;
+    }
     pthread_mutex_unlock(&visited_mutex);
     
     if (!result) {
-        free(url_copy);
-        return 0;
+        free(url_copy);  // table full
+        return -1;
+    }
+    if (!added) {
+        free(url_copy);  // already present, hsearch kept the old key
+        return reclaimed;
     }
+    mem_charge(charged);
     return 1;
 }
 
 void cleanup_visited_hash_table() {
-    if (hash_table_initialized) {
+    if (visited_filter) {
+        url_filter_destroy(visited_filter);
+        visited_filter = NULL;
+    } else if (hash_table_initialized) {
         hdestroy();
-        hash_table_initialized = 0;
     }
+    hash_table_initialized = 0;
+    queue_destroy(&visited_keys);
+    mem_release(visited_bytes);
+    visited_bytes = 0;
 }
 
 // Curl callbacks
@@ -197,11 +780,16 @@ size_t write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
         if (new_capacity < m->len + total + 1) {
             new_capacity = m->len + total + 1;
         }
+        // A single response may use at most its share of a quarter of the budget
+        if (mem_limit && new_capacity > mem_limit / 4 / (T * num_tasks)) {
+            return 0;
+        }
         char *new_data = realloc(m->data, new_capacity);
         if (!new_data) {
             fprintf(stderr, "write_cb: realloc failed, len=%zu, total=%zu\n", m->len, total);
             return 0;
         }
+        mem_charge(new_capacity - m->capacity);
         m->data = new_data;
         m->capacity = new_capacity;
     }
@@ -212,31 +800,93 @@ size_t write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
     return total;
 }
 
+// Body callback of a fetch task. With --verify a PNG body goes through the
+// verifier as it arrives and is not kept, unless the archive needs it.
+size_t task_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    fetch_task_t *t = userdata;
+    if (verify_pngs && t->hdr.content_type == CONTENT_PNG) {
+        png_verify_feed(&t->verify, ptr, size * nmemb);
+        t->verify_fed = 1;
+        if (!record_file) {
+            return size * nmemb;
+        }
+    }
+    return write_cb(ptr, size, nmemb, &t->resp);
+}
+
 size_t header_cb(char *buffer, size_t size, size_t nitems, void *userdata) {
     size_t realsize = size * nitems;
-    int *content_type = (int *)userdata;
-    if (!content_type) return realsize;
-    
-    // Copy buffer to a null-terminated string
-    size_t copy_len = realsize < URL_MAX_LEN ? realsize : URL_MAX_LEN - 1;
-    char *tmp = malloc(copy_len + 1);
-    if (!tmp) {
-        fprintf(stderr, "header_cb: malloc failed\n");
+    resp_hdr_t *hdr = (resp_hdr_t *)userdata;
+    if (!hdr) return realsize;
+    if (hdr->keep_raw && write_cb(buffer, 1, realsize, &hdr->raw) != realsize) {
+        return 0;
+    }
+
+    // A status line starts a new response (e.g. after a redirect)
+    if (realsize >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        hdr->content_type = CONTENT_UNKNOWN;
+        hdr->etag[0] = '\0';
+        hdr->last_modified[0] = '\0';
+        const char *code = memchr(buffer, ' ', realsize);
+        hdr->hop_status = code ? strtol(code + 1, NULL, 10) : 0;
         return realsize;
     }
-    memcpy(tmp, buffer, copy_len);
-    tmp[copy_len] = '\0';
-    
-    if (strstr(tmp, "Content-Type: text/html")) {
-        *content_type = CONTENT_HTML;
-    } else if (strstr(tmp, "Content-Type: image/png")) {
-        *content_type = CONTENT_PNG;
+
+    const char *colon = memchr(buffer, ':', realsize);
+    if (!colon) return realsize;
+    size_t name_len = colon - buffer;
+    const char *value = colon + 1;
+    const char *end = buffer + realsize;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    while (end > value && isspace((unsigned char)end[-1])) end--;
+    size_t value_len = end - value;
+
+    // Header names are case-insensitive
+    if (name_len == 12 && strncasecmp(buffer, "Content-Type", 12) == 0) {
+        if (value_len >= 9 && strncasecmp(value, "text/html", 9) == 0) {
+            hdr->content_type = CONTENT_HTML;
+        } else if (value_len >= 9 && strncasecmp(value, "image/png", 9) == 0) {
+            hdr->content_type = CONTENT_PNG;
+        }
+    } else if (name_len == 4 && strncasecmp(buffer, "ETag", 4) == 0 && value_len < CACHE_VALUE_MAX) {
+        memcpy(hdr->etag, value, value_len);
+        hdr->etag[value_len] = '\0';
+    } else if (name_len == 13 && strncasecmp(buffer, "Last-Modified", 13) == 0 && value_len < CACHE_VALUE_MAX) {
+        memcpy(hdr->last_modified, value, value_len);
+        hdr->last_modified[value_len] = '\0';
+    } else if (name_len == 8 && strncasecmp(buffer, "Location", 8) == 0 &&
+               hdr->hop_status >= 300 && hdr->hop_status < 400 && value_len > 0) {
+        // Remember the hop; it is resolved once the fetch is over
+        if (write_cb((char *)value, 1, value_len, &hdr->locations) != value_len ||
+            write_cb("", 1, 1, &hdr->locations) != 1) {
+            return 0;
+        }
     }
-    
-    free(tmp);
     return realsize;
 }
 
+// Clear the per-response fields, keeping the raw header buffer for reuse
+void resp_hdr_reset(resp_hdr_t *hdr) {
+    hdr->content_type = CONTENT_UNKNOWN;
+    hdr->etag[0] = '\0';
+    hdr->last_modified[0] = '\0';
+    hdr->raw.len = 0;
+    hdr->hop_status = 0;
+    hdr->locations.len = 0;
+}
+
+// Run a recorded header block through header_cb one line at a time
+void replay_headers(const char *headers, size_t len, resp_hdr_t *hdr) {
+    const char *pos = headers;
+    const char *end = headers + len;
+    while (pos < end) {
+        const char *nl = memchr(pos, '\n', end - pos);
+        const char *line_end = nl ? nl + 1 : end;
+        header_cb((char *)pos, 1, line_end - pos, hdr);
+        pos = line_end;
+    }
+}
+
 // PNG verification
 int is_png(mem_t *m) {
     if (!m || !m->data || m->len < PNG_SIG_LEN) {
@@ -245,76 +895,56 @@ int is_png(mem_t *m) {
     return memcmp(m->data, PNG_SIGNATURE, PNG_SIG_LEN) == 0;
 }
 
-// URL resolution
-char *resolve_url(const char *base_url, const char *relative_url) {
-    if (!relative_url || !base_url) {
-        return NULL;
+// URL resolution: write rel_len bytes of relative_url resolved against
+// base_url to out, which holds URL_MAX_LEN bytes. Returns the length, 0 if
+// it cannot be resolved or does not fit.
+size_t resolve_url_into(const char *base_url, const char *relative_url, size_t rel_len, char *out) {
+    if (!relative_url || !base_url || rel_len == 0) {
+        return 0;
     }
     
     // Check for absolute URL
-    if (strncmp(relative_url, "http://", 7) == 0 || strncmp(relative_url, "https://", 8) == 0) {
-        size_t len = strlen(relative_url);
-        if (len >= URL_MAX_LEN) return NULL;
-        char *result = malloc(len + 1);
-        if (result) {
-            memcpy(result, relative_url, len + 1);
-        }
-        return result;
-    }
-    
-    char *result = malloc(URL_MAX_LEN);
-    if (!result) {
-        return NULL;
+    if ((rel_len >= 7 && memcmp(relative_url, "http://", 7) == 0) ||
+        (rel_len >= 8 && memcmp(relative_url, "https://", 8) == 0)) {
+        if (rel_len >= URL_MAX_LEN) return 0;
+        memcpy(out, relative_url, rel_len);
+        out[rel_len] = '\0';
+        return rel_len;
     }
     
+    size_t prefix_len;
+    int add_slash = 0;
     if (relative_url[0] == '/') {
-        // Absolute path
+        // Absolute path, joined to scheme and host
         const char *proto_end = strstr(base_url, "://");
-        if (proto_end) {
-            proto_end += 3;
-            const char *host_end = strchr(proto_end, '/');
-            size_t host_len = host_end ? (size_t)(host_end - base_url) : strlen(base_url);
-            if (host_len + strlen(relative_url) >= URL_MAX_LEN) {
-                free(result);
-                return NULL;
-            }
-            snprintf(result, URL_MAX_LEN, "%.*s%s", (int)host_len, base_url, relative_url);
-        } else {
-            free(result);
-            return NULL;
-        }
+        if (!proto_end) return 0;
+        const char *host_end = strchr(proto_end + 3, '/');
+        prefix_len = host_end ? (size_t)(host_end - base_url) : strlen(base_url);
     } else {
-        // Relative path
+        // Relative path, joined to the base's directory
         size_t base_len = strlen(base_url);
-        if (base_len >= URL_MAX_LEN) {
-            free(result);
-            return NULL;
-        }
-        char *base_copy = malloc(base_len + 1);
-        if (!base_copy) {
-            free(result);
-            return NULL;
-        }
-        memcpy(base_copy, base_url, base_len + 1);
-        
-        char *last_slash = strrchr(base_copy, '/');
-        if (last_slash && last_slash > base_copy + 7) {
-            *last_slash = '\0';
-            if (strlen(base_copy) + strlen(relative_url) + 1 >= URL_MAX_LEN) {
-                free(base_copy);
-                free(result);
-                return NULL;
-            }
-            snprintf(result, URL_MAX_LEN, "%s/%s", base_copy, relative_url);
-        } else {
-            if (base_len + strlen(relative_url) + 1 >= URL_MAX_LEN) {
-                free(base_copy);
-                free(result);
-                return NULL;
-            }
-            snprintf(result, URL_MAX_LEN, "%s/%s", base_url, relative_url);
-        }
-        free(base_copy);
+        if (base_len >= URL_MAX_LEN) return 0;
+        const char *last_slash = strrchr(base_url, '/');
+        prefix_len = last_slash && last_slash > base_url + 7 ? (size_t)(last_slash - base_url) : base_len;
+        add_slash = 1;
+    }
+    if (prefix_len + add_slash + rel_len >= URL_MAX_LEN) return 0;
+    memcpy(out, base_url, prefix_len);
+    if (add_slash) out[prefix_len] = '/';
+    memcpy(out + prefix_len + add_slash, relative_url, rel_len);
+    size_t len = prefix_len + add_slash + rel_len;
+    out[len] = '\0';
+    return len;
+}
+
+// Resolved URL in a new allocation, NULL on failure
+char *resolve_url(const char *base_url, const char *relative_url) {
+    char buf[URL_MAX_LEN];
+    size_t len = relative_url ? resolve_url_into(base_url, relative_url, strlen(relative_url), buf) : 0;
+    if (len == 0) return NULL;
+    char *result = malloc(len + 1);
+    if (result) {
+        memcpy(result, buf, len + 1);
     }
     return result;
 }
@@ -325,7 +955,7 @@ int is_valid_url(const char *url) {
     return (strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0);
 }
 
-// HTML URL extraction
+// HTML URL extraction, appends every absolute http(s) link to list
 void extract_urls(const char *html, const char *base_url, url_list_t *list) {
     if (!html || !base_url || !list) {
         return;
@@ -391,150 +1021,1445 @@ void extract_urls(const char *html, const char *base_url, url_list_t *list) {
             continue;
         }
         
-        char *url = malloc(url_len + 1);
-        if (!url) {
-            pos = url_end + (quote && url_end < data_end ? 1 : 0);
-            continue;
-        }
-        memcpy(url, url_start, url_len);
-        url[url_len] = '\0';
-        
-        char *absolute_url = resolve_url(base_url, url);
-        free(url);
-        
-        if (absolute_url && is_valid_url(absolute_url)) {
-            if (!is_url_visited(absolute_url)) {
-                char *url_copy = malloc(strlen(absolute_url) + 1);
-                if (url_copy) {
-                    strcpy(url_copy, absolute_url);
-                    queue_push(list, url_copy);
+        // Resolve and scope check on the stack, only links kept are allocated
+        char absolute[URL_MAX_LEN];
+        size_t abs_len = resolve_url_into(base_url, url_start, url_len, absolute);
+        if (abs_len && is_valid_url(absolute)) {
+            if (!scope_allows(&crawl_scope, absolute, abs_len)) {
+                atomic_fetch_add(&stat_out_of_scope, 1);
+            } else {
+                char *absolute_url = malloc(abs_len + 1);
+                if (absolute_url) {
+                    memcpy(absolute_url, absolute, abs_len + 1);
+                    if (!list_append(list, absolute_url)) {
+                        free(absolute_url);
+                    }
                 }
             }
-            free(absolute_url);
-        } else if (absolute_url) {
-            free(absolute_url);
         }
         
         pos = url_end + (quote && url_end < data_end ? 1 : 0);
     }
 }
 
-// Fetcher thread
-void *fetcher_thread(void *arg) {
-    (void)arg;
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "Thread %ld: curl_easy_init failed\n", pthread_self());
-        return NULL;
-    }
-    
-    mem_t resp = {NULL, 0, 0};
-    resp.data = malloc(1024);  // Initial buffer
-    resp.capacity = 1024;
-    if (!resp.data) {
-        curl_easy_cleanup(curl);
-        return NULL;
-    }
-    
-    int content_type = CONTENT_UNKNOWN;
-    
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &content_type);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "findpng2/1.0");
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    
-    pthread_mutex_lock(&count_mutex);
-    active_threads++;
-    pthread_mutex_unlock(&count_mutex);
-    
-    while (!should_exit) {
-        // Check if we've reached the limit
-        pthread_mutex_lock(&count_mutex);
-        if (png_count >= M) {
-            should_exit = 1;
-            pthread_mutex_unlock(&count_mutex);
-            pthread_mutex_lock(&frontier_mutex);
-            pthread_cond_broadcast(&frontier_not_empty);
-            pthread_mutex_unlock(&frontier_mutex);
-            break;
-        }
-        pthread_mutex_unlock(&count_mutex);
-        
-        char *url = queue_pop(&frontier_list);
-        if (!url) {
-            break;
-        }
-        
-        if (!is_valid_url(url)) {
-            free(url);
+// Push the not yet visited links of a page to the frontier in one batch
+void enqueue_links(char **links, unsigned count) {
+    char **batch = malloc(count * sizeof(char *));
+    if (!batch) return;
+    unsigned n = 0;
+    for (unsigned i = 0; i < count; i++) {
+        // Cached outlinks may predate the current scope rules
+        if (!scope_allows(&crawl_scope, links[i], strlen(links[i]))) {
+            atomic_fetch_add(&stat_out_of_scope, 1);
             continue;
         }
-        
-        // Check if already visited and add to visited set
-        if (is_url_visited(url)) {
-            free(url);
+        // Links to hosts of another partition go to their owner via the coordinator
+        if (part_index >= 0 && partition_of(links[i], num_procs) != (unsigned)part_index) {
+            part_post('U', links[i]);
             continue;
         }
-        
-        if (!add_to_visited(url)) {
-            free(url);
+        if (is_url_visited(links[i])) {
             continue;
         }
-        
-        // Log the URL
-        if (log_fp) {
-            pthread_mutex_lock(&log_mutex);
-            fprintf(log_fp, "%s\n", url);
-            fflush(log_fp);
-            pthread_mutex_unlock(&log_mutex);
-        }
-        
-        // Reset response buffer
-        resp.len = 0;
-        resp.data[0] = '\0';
-        content_type = CONTENT_UNKNOWN;
-        
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        CURLcode res = curl_easy_perform(curl);
-        
-        if (res == CURLE_OK) {
-            if (content_type == CONTENT_PNG && is_png(&resp)) {
-                pthread_mutex_lock(&count_mutex);
-                if (png_count < M) {
-                    pthread_mutex_lock(&log_mutex);
-                    fprintf(png_urls_fp, "%s\n", url);
-                    fflush(png_urls_fp);
-                    pthread_mutex_unlock(&log_mutex);
-                    png_count++;
-                    printf("Thread %ld: Found PNG %s (%d/%d)\n", pthread_self(), url, png_count, M);
-                }
-                pthread_mutex_unlock(&count_mutex);
-            } else if (content_type == CONTENT_HTML && resp.data && resp.len > 0) {
-                extract_urls(resp.data, url, &frontier_list);
-            }
-        }
-        
+        batch[n++] = links[i];
+    }
+    queue_push_many(&frontier, batch, n);
+    free(batch);
+}
+
+// Build the conditional request headers for a cached entry
+struct curl_slist *cache_conditional_headers(const cache_entry_t *entry) {
+    char line[CACHE_VALUE_MAX + 32];
+    struct curl_slist *headers = NULL;
+    if (entry->etag[0]) {
+        snprintf(line, sizeof(line), "If-None-Match: %s", entry->etag);
+        headers = curl_slist_append(headers, line);
+    }
+    if (entry->last_modified[0]) {
+        snprintf(line, sizeof(line), "If-Modified-Since: %s", entry->last_modified);
+        headers = curl_slist_append(headers, line);
+    }
+    return headers;
+}
+
+// Remember validators and outlinks of a fresh response
+void cache_update(const char *url, const resp_hdr_t *hdr, url_list_t *links) {
+    if (!cache_dir || (!hdr->etag[0] && !hdr->last_modified[0])) {
+        return;  // nothing to revalidate with
+    }
+    cache_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.etag, hdr->etag, sizeof(entry.etag));
+    memcpy(entry.last_modified, hdr->last_modified, sizeof(entry.last_modified));
+    entry.content_type = hdr->content_type;
+    if (links) {
+        entry.links = links->urls;
+        entry.num_links = links->count;
+    }
+    cache_store(url, &entry);
+}
+
+// Count a PNG toward M
+void record_png(const char *url) {
+    int stream = 0;
+    pthread_mutex_lock(&count_mutex);
+    if (png_count < M && part_index >= 0) {
+        // The coordinator owns the global count and png_urls.txt
+        png_count++;
+        part_post('P', url);
+    } else if (png_count < M) {
+        pthread_mutex_lock(&log_mutex);
+        fprintf(png_urls_fp, "%s\n", url);
+        fflush(png_urls_fp);
+        pthread_mutex_unlock(&log_mutex);
+        png_count++;
+        if (job_fd >= 0) {
+            stream = 1;
+        } else {
+            printf("Thread %ld: Found PNG %s (%d/%d)\n", pthread_self(), url, png_count, M);
+        }
+    }
+    pthread_mutex_unlock(&count_mutex);
+    // Stream to the daemon client outside count_mutex, a slow client only
+    // holds up the threads that found a PNG
+    if (stream) {
+        pthread_mutex_lock(&job_mutex);
+        dprintf(job_fd, "PNG %s\n", url);
+        pthread_mutex_unlock(&job_mutex);
+    }
+}
+
+// Turn a finished curl transfer into a fetch result and record it if asked
+void fetch_done(CURL *curl, const char *url, int ok, mem_t *resp, resp_hdr_t *hdr, fetch_result_t *out) {
+    out->ok = ok;
+    out->status = 0;
+    out->effective_url = NULL;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out->status);
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &out->effective_url);
+    out->body = resp->data;
+    out->body_len = resp->len;
+    if (record_file) {
+        archive_record(url, out->ok ? out->status : 0, hdr->raw.data, hdr->raw.len,
+                       out->ok ? resp->data : NULL, resp->len);
+    }
+}
+
+// Fetch url with curl, or serve it from the replay archive without copying
+void fetch_url(CURL *curl, const char *url, mem_t *resp, resp_hdr_t *hdr, fetch_result_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (replay_file) {
+        if (replay_latency_ms > 0) {
+            struct timespec delay = { replay_latency_ms / 1000, (replay_latency_ms % 1000) * 1000000L };
+            nanosleep(&delay, NULL);
+        }
+        archive_resp_t rec;
+        if (!archive_lookup(url, &rec) || rec.status == 0) {
+            return;
+        }
+        replay_headers(rec.headers, rec.hdr_len, hdr);
+        out->ok = 1;
+        out->status = rec.status;
+        out->body = rec.body;
+        out->body_len = rec.body_len;
+        return;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    fetch_done(curl, url, curl_easy_perform(curl) == CURLE_OK, resp, hdr, out);
+}
+
+// Take a handle parked by an earlier daemon job, NULL if there is none
+void *handle_take(handle_pool_t *p) {
+    pthread_mutex_lock(&warm_mutex);
+    void *h = p->count > 0 ? p->handles[--p->count] : NULL;
+    pthread_mutex_unlock(&warm_mutex);
+    return h;
+}
+
+// Park a handle for the next daemon job, 0 if the caller must free it
+int handle_park(handle_pool_t *p, void *h) {
+    if (!keep_handles) return 0;
+    pthread_mutex_lock(&warm_mutex);
+    if (p->count == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 16;
+        void **handles = realloc(p->handles, cap * sizeof(*handles));
+        if (!handles) {
+            pthread_mutex_unlock(&warm_mutex);
+            return 0;
+        }
+        p->handles = handles;
+        p->cap = cap;
+    }
+    p->handles[p->count++] = h;
+    pthread_mutex_unlock(&warm_mutex);
+    return 1;
+}
+
+// An easy handle with default options, one parked by an earlier job if any.
+// curl_easy_reset keeps its live connections and caches.
+CURL *easy_handle_get(void) {
+    CURL *curl = handle_take(&warm_easy);
+    if (!curl) return curl_easy_init();
+    curl_easy_reset(curl);
+    return curl;
+}
+
+void easy_handle_put(CURL *curl) {
+    if (!handle_park(&warm_easy, curl)) curl_easy_cleanup(curl);
+}
+
+CURLM *multi_handle_get(void) {
+    CURLM *multi = handle_take(&warm_multi);
+    return multi ? multi : curl_multi_init();
+}
+
+void multi_handle_put(CURLM *multi) {
+    if (!handle_park(&warm_multi, multi)) curl_multi_cleanup(multi);
+}
+
+// Set up a task's easy handle and buffers, 1 on success
+int fetch_task_init(fetch_task_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->curl = easy_handle_get();
+    if (!t->curl) {
+        return 0;
+    }
+    t->resp.data = malloc(1024);  // Initial buffer
+    t->resp.capacity = 1024;
+    if (!t->resp.data) {
+        easy_handle_put(t->curl);
+        t->curl = NULL;
+        return 0;
+    }
+    if (verify_pngs && !png_verify_init(&t->verify)) {
+        free(t->resp.data);
+        t->resp.data = NULL;
+        easy_handle_put(t->curl);
+        t->curl = NULL;
+        return 0;
+    }
+    mem_charge(t->resp.capacity);
+    t->hdr.keep_raw = record_file != NULL;
+    
+    CURL *curl = t->curl;
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, task_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, t);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &t->hdr);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, t);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "findpng2/1.0");
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms);
+    if (curl_share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+        curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+    }
+    return 1;
+}
+
+// Drop whatever the task holds for its current URL
+void fetch_task_release(fetch_task_t *t) {
+    if (t->curl) {
+        curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, NULL);
+    }
+    curl_slist_free_all(t->cond_headers);
+    t->cond_headers = NULL;
+    if (t->have_cached) {
+        cache_entry_free(&t->cached);
+        t->have_cached = 0;
+    }
+    free(t->url);
+    t->url = NULL;
+}
+
+void fetch_task_cleanup(fetch_task_t *t) {
+    fetch_task_release(t);
+    if (t->curl) {
+        easy_handle_put(t->curl);
+        t->curl = NULL;
+    }
+    if (verify_pngs) {
+        png_verify_destroy(&t->verify);
+    }
+    mem_release(t->resp.capacity + t->hdr.raw.capacity + t->hdr.locations.capacity);
+    free(t->resp.data);
+    free(t->hdr.raw.data);
+    free(t->hdr.locations.data);
+    t->resp.data = t->hdr.raw.data = t->hdr.locations.data = NULL;
+    t->resp.capacity = t->hdr.raw.capacity = t->hdr.locations.capacity = 0;
+}
+
+// Timeout for a fetch from host: a multiple of the host's p99 latency once
+// enough fetches from it are in, doubled for every retry, capped at the
+// --timeout default
+long fetch_timeout_for(unsigned host, unsigned attempt) {
+    long ms = host_latency_quantile_ms(host, 0.99, TIMEOUT_MIN_SAMPLES);
+    if (ms < 0) return fetch_timeout_ms;
+    ms = ms * TIMEOUT_P99_FACTOR << attempt;
+    if (ms < TIMEOUT_FLOOR_MS) ms = TIMEOUT_FLOOR_MS;
+    return ms < fetch_timeout_ms ? ms : fetch_timeout_ms;
+}
+
+// Claim url for the task: skip it if invalid or already visited, otherwise
+// mark it visited and prepare the request. A retry (attempt > 0) was claimed
+// by its first try. Takes ownership of url; returns 0 when there is nothing
+// to fetch.
+int fetch_task_begin(fetch_task_t *t, char *url, unsigned attempt) {
+    if (!is_valid_url(url) || (attempt == 0 && add_to_visited(url) != 1)) {
         free(url);
+        return 0;
+    }
+    t->url = url;
+    t->attempt = attempt;
+    t->host = host_intern(url);
+    t->start_ns = now_ns();
+    
+    // Log the URL
+    if (log_fp) {
+        pthread_mutex_lock(&log_mutex);
+        fprintf(log_fp, "%s\n", url);
+        fflush(log_fp);
+        pthread_mutex_unlock(&log_mutex);
+    }
+    
+    // Reset response buffer
+    t->resp.len = 0;
+    t->resp.data[0] = '\0';
+    resp_hdr_reset(&t->hdr);
+    if (verify_pngs) {
+        png_verify_reset(&t->verify);
+        t->verify_fed = 0;
+    }
+
+    // Revalidate against the cache if we have seen this URL before
+    t->have_cached = cache_dir && cache_load(url, &t->cached);
+    t->cond_headers = t->have_cached ? cache_conditional_headers(&t->cached) : NULL;
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, t->cond_headers);
+    curl_easy_setopt(t->curl, CURLOPT_URL, url);
+    curl_easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, fetch_timeout_for(t->host, attempt));
+    return 1;
+}
+
+// Walk the redirect hops of a finished fetch from the request URL and claim
+// every URL on the way in the visited set, so aliases of a page are fetched
+// once. Returns the final URL (NULL when there was no redirect); *alias is
+// set when that URL had already been claimed by another fetch.
+char *claim_redirects(const char *url, const resp_hdr_t *hdr, const fetch_result_t *fr, int *alias) {
+    *alias = 0;
+    unsigned hops = 0;
+    for (size_t off = 0; off < hdr->locations.len; off += strlen(hdr->locations.data + off) + 1) {
+        hops++;
+    }
+    // A final 3xx means the last Location was not followed (too many hops)
+    if (hops > 0 && fr->status >= 300 && fr->status < 400) {
+        hops--;
+    }
+    if (hops == 0 && !(fr->effective_url && strcmp(fr->effective_url, url) != 0)) {
+        return NULL;
+    }
+
+    char *cur = NULL;
+    const char *loc = hdr->locations.data;
+    for (unsigned i = 0; i < hops; i++, loc += strlen(loc) + 1) {
+        char *next = resolve_url(cur ? cur : url, loc);
+        if (!next) break;
+        free(cur);
+        cur = next;
+        if (i + 1 < hops) {
+            add_to_visited(cur);  // intermediate hop
+        }
+    }
+    // curl knows best where it ended up
+    if (fr->effective_url && strcmp(fr->effective_url, url) != 0 &&
+        (!cur || strcmp(cur, fr->effective_url) != 0)) {
+        free(cur);
+        cur = strdup(fr->effective_url);
+    }
+    if (!cur || strcmp(cur, url) == 0) {
+        free(cur);
+        return NULL;
+    }
+    *alias = add_to_visited(cur) == 0;
+    atomic_fetch_add(&stat_redirected, 1);
+    if (*alias) atomic_fetch_add(&stat_aliases, 1);
+    return cur;
+}
+
+// 1 if a page with the same body was already parsed under the same base
+// directory. Relative links resolve against that directory, so such a page
+// has exactly the same outlinks and needs neither parsing nor link insertion.
+int page_seen(const char *url, const char *body, size_t len) {
+    const char *path = strstr(url, "://");
+    path = path ? path + 3 : url;
+    size_t base_len = path - url;
+    for (const char *p = path; *p && *p != '?' && *p != '#'; p++) {
+        if (*p == '/') base_len = p - url + 1;
+    }
+    uint64_t fp = fp_hash64(body, len, fp_hash64(url, base_len, 0));
+    size_t grown;
+    int fresh = fp_set_insert(fp, &grown);
+    if (grown) mem_charge(grown);
+    atomic_fetch_add(&stat_pages_hashed, 1);
+    if (fresh) return 0;
+    atomic_fetch_add(&stat_duplicates, 1);
+    atomic_fetch_add(&stat_duplicate_bytes, len);
+    return 1;
+}
+
+// Duplicate ratio on stderr, per worker process in a partitioned crawl
+void report_dedup(void) {
+    if (!dedup) return;
+    unsigned long pages = atomic_load(&stat_pages_hashed);
+    unsigned long dups = atomic_load(&stat_duplicates);
+    char who[32] = "";
+    if (part_index >= 0) snprintf(who, sizeof(who), " worker %d", part_index);
+    fprintf(stderr, "findpng2%s: %lu of %lu HTML pages were duplicates (%.1f%%), %llu bytes not parsed, "
+            "%zu bytes of fingerprints\n",
+            who, dups, pages, pages ? 100.0 * dups / pages : 0.0, atomic_load(&stat_duplicate_bytes),
+            fp_set_bytes());
+}
+
+void parse_job_free(parse_job_t *job) {
+    if (job->charged) {
+        free(job->body);
+        mem_release(job->charged);
+    }
+    free(job->url);
+    free(job->base_url);
+    free(job);
+}
+
+// One page fewer in the parse stage; may let idle fetchers end the crawl
+void parse_job_done(void) {
+    pthread_mutex_lock(&frontier_mutex);
+    parse_pending--;
+    if (parse_pending == 0 && idle_threads > 0) {
+        pthread_cond_broadcast(&frontier_not_empty);
+    }
+    part_report_idle();
+    pthread_mutex_unlock(&frontier_mutex);
+}
+
+// Hand the task's page to the parser pool. The response buffer moves to the
+// job and the task gets a fresh one; bodies in the replay mapping are
+// borrowed, bodies in a buffer the fetcher reuses are copied. Takes the URL
+// and the final URL after redirects, if any.
+// Returns 0 if the page should be parsed inline instead.
+int parse_submit(fetch_task_t *t, const fetch_result_t *fr, char **base_url) {
+    parse_job_t *job = malloc(sizeof(*job));
+    if (!job) return 0;
+    job->body_len = fr->body_len;
+    job->charged = 0;
+    if (fr->body == t->resp.data) {
+        char *fresh = malloc(1024);
+        if (!fresh) {
+            free(job);
+            return 0;
+        }
+        mem_charge(1024);
+        job->body = t->resp.data;
+        job->charged = t->resp.capacity;
+        t->resp.data = fresh;
+        t->resp.capacity = 1024;
+        t->resp.len = 0;
+        fresh[0] = '\0';
+    } else if (replay_file) {
+        job->body = (char *)fr->body;  // the archive mapping outlives the crawl
+    } else {
+        job->body = malloc(fr->body_len + 1);
+        if (!job->body) {
+            free(job);
+            return 0;
+        }
+        memcpy(job->body, fr->body, fr->body_len);
+        job->body[fr->body_len] = '\0';
+        job->charged = fr->body_len + 1;
+        mem_charge(job->charged);
+    }
+    job->hdr = t->hdr;
+    job->hdr.keep_raw = 0;
+    job->hdr.raw = (mem_t){ NULL, 0, 0 };
+    job->hdr.locations = (mem_t){ NULL, 0, 0 };
+    job->url = t->url;
+    t->url = NULL;
+    job->base_url = *base_url;
+    *base_url = NULL;
+
+    pthread_mutex_lock(&frontier_mutex);
+    parse_pending++;
+    if (parse_pending > parse_pending_peak) parse_pending_peak = parse_pending;
+    pthread_mutex_unlock(&frontier_mutex);
+
+    // Bounded queue: a full one means the parsers are the bottleneck, wait
+    int queued = mpmc_push(&parse_queue, job);
+    if (!queued) {
+        unsigned long long start = now_ns();
+        struct timespec pause = { 0, 50000 };
+        while (!should_exit && !(queued = mpmc_push(&parse_queue, job))) {
+            nanosleep(&pause, NULL);
+        }
+        atomic_fetch_add(&stat_handoff_ns, now_ns() - start);
+    }
+    if (!queued) {
+        parse_job_free(job);
+        parse_job_done();
+        return 1;
+    }
+    atomic_fetch_add(&stat_handed_off, 1);
+    sem_post(&parse_ready);
+    return 1;
+}
+
+// Parser thread: extract links from queued pages and feed the frontier
+void *parser_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        while (sem_wait(&parse_ready) != 0 && errno == EINTR);
+        // Every post but the stop ones is for a job; its producer may have
+        // claimed the cell and not published it yet, so keep trying until it
+        // shows. Giving up would leave the job without a post to wake anyone.
+        parse_job_t *job;
+        while (!(job = mpmc_pop(&parse_queue)) && !parse_stop) {
+            sched_yield();
+        }
+        if (!job) break;  // a stop post, everything was pushed before it
+        if (!should_exit) {
+            unsigned long long start = now_ns();
+            url_list_t links = { .urls = NULL, .count = 0, .capacity = 0 };
+            extract_urls(job->body, job->base_url ? job->base_url : job->url, &links);
+            cache_update(job->url, &job->hdr, &links);
+            atomic_fetch_add(&stat_links, links.count);
+            enqueue_links(links.urls, links.count);
+            queue_destroy(&links);
+            atomic_fetch_add(&stat_parse_ns, now_ns() - start);
+            atomic_fetch_add(&stat_parsed, 1);
+        }
+        parse_job_free(job);
+        parse_job_done();
+    }
+    return NULL;
+}
+
+// Feed the outcome of a network fetch into its host's statistics. Returns 1
+// when the fetch failed in a way worth another try (transport error, 5xx,
+// 429) and the URL has been scheduled for it.
+int fetch_task_retry(fetch_task_t *t, const fetch_result_t *fr) {
+    if (replay_file) {
+        return 0;  // a replayed miss stays a miss
+    }
+    if (fr->ok && fr->status < 500 && fr->status != 429) {
+        host_record_latency(t->host, (now_ns() - t->start_ns) / 1000);
+        return 0;
+    }
+    unsigned failures = host_record_failure(t->host);
+    if (t->attempt >= max_retries || failures >= HOST_FAILURE_LIMIT) {
+        atomic_fetch_add(&stat_failed, 1);
+        return 0;
+    }
+    retry_schedule(t->url, t->attempt + 1);
+    t->url = NULL;
+    return 1;
+}
+
+// Whether a PNG response counts: its signature, or with --verify its whole
+// structure. A body curl delivered was verified as it arrived; replayed and
+// io_uring bodies are already in memory and are verified here.
+int png_accepted(fetch_task_t *t, mem_t *body) {
+    if (!verify_pngs) {
+        return is_png(body);
+    }
+    if (!t->verify_fed && body->data) {
+        png_verify_feed(&t->verify, body->data, body->len);
+    }
+    if (png_verify_finish(&t->verify)) {
+        return 1;
+    }
+    atomic_fetch_add(&stat_png_rejected, 1);
+    fprintf(stderr, "findpng2: rejected %s: %s\n", t->url, t->verify.error);
+    return 0;
+}
+
+// Act on a fetched page (record a PNG, queue its links), then release the URL
+void fetch_task_finish(fetch_task_t *t, const fetch_result_t *fr) {
+    if (fetch_task_retry(t, fr)) {
+        fetch_task_release(t);
+        return;
+    }
+    const char *url = t->url;
+    mem_t body = { (char *)fr->body, fr->body_len, fr->body_len };
+    int alias = 0;
+    char *final_url = fr->ok ? claim_redirects(url, &t->hdr, fr, &alias) : NULL;
+    const char *base = final_url ? final_url : url;
+    
+    if (alias) {
+        // Redirected to a page another fetch already claimed: nothing new here
+    } else if (final_url && !scope_allows(&crawl_scope, final_url, strlen(final_url))) {
+        // curl followed a redirect out of scope: drop what it brought back
+        atomic_fetch_add(&stat_out_of_scope, 1);
+    } else if (fr->ok && fr->status == 304 && t->have_cached) {
+        // Not modified: reuse the cached outlinks without parsing
+        if (t->cached.content_type == CONTENT_PNG) {
+            record_png(url);
+        } else if (t->cached.content_type == CONTENT_HTML) {
+            enqueue_links(t->cached.links, t->cached.num_links);
+        }
+    } else if (fr->ok) {
+        if (t->hdr.content_type == CONTENT_PNG && png_accepted(t, &body)) {
+            cache_update(url, &t->hdr, NULL);
+            record_png(url);
+        } else if (t->hdr.content_type == CONTENT_HTML && body.data && body.len > 0 &&
+                   !(dedup && page_seen(base, body.data, body.len)) &&
+                   !(num_parsers > 0 && parse_submit(t, fr, &final_url))) {
+            // Relative links are relative to where the redirects ended
+            url_list_t links = { .urls = NULL, .count = 0, .capacity = 0 };
+            extract_urls(body.data, base, &links);
+            cache_update(url, &t->hdr, &links);
+            enqueue_links(links.urls, links.count);
+            queue_destroy(&links);
+        }
+    }
+    
+    // Give back memory held by an unusually large response
+    if (t->resp.capacity > RESP_KEEP_CAPACITY) {
+        char *small = realloc(t->resp.data, RESP_KEEP_CAPACITY);
+        if (small) {
+            mem_release(t->resp.capacity - RESP_KEEP_CAPACITY);
+            t->resp.data = small;
+            t->resp.capacity = RESP_KEEP_CAPACITY;
+        }
+    }
+    free(final_url);
+    fetch_task_release(t);
+}
+
+// Stop the crawl once M PNGs are in, 1 if it is over
+int png_limit_reached(void) {
+    pthread_mutex_lock(&count_mutex);
+    if (png_count < M) {
+        pthread_mutex_unlock(&count_mutex);
+        return 0;
+    }
+    should_exit = 1;
+    pthread_mutex_unlock(&count_mutex);
+    pthread_mutex_lock(&frontier_mutex);
+    pthread_cond_broadcast(&frontier_not_empty);
+    pthread_mutex_unlock(&frontier_mutex);
+    return 1;
+}
+
+// Bookkeeping when a fetcher thread leaves
+void fetcher_exit(void) {
+    pthread_mutex_lock(&count_mutex);
+    active_threads--;
+    if (active_threads == 0 || png_count >= M) {
+        should_exit = 1;
+        pthread_mutex_lock(&frontier_mutex);
+        pthread_cond_broadcast(&frontier_not_empty);
+        pthread_mutex_unlock(&frontier_mutex);
+    }
+    pthread_mutex_unlock(&count_mutex);
+}
+
+// Bookkeeping when a fetcher thread cannot start: it counts as idle for
+// good, so the others can still agree that the crawl is over
+void fetcher_failed(void) {
+    pthread_mutex_lock(&frontier_mutex);
+    idle_threads++;
+    if (idle_threads == T && part_index < 0 && frontier.count == 0 && spill_pending == 0 &&
+        parse_pending == 0 && retry_count == 0) {
+        should_exit = 1;
+        pthread_cond_broadcast(&frontier_not_empty);
+    } else {
+        part_report_idle();
+    }
+    pthread_mutex_unlock(&frontier_mutex);
+}
+
+// Fetcher thread, one blocking fetch at a time
+void *fetcher_thread(void *arg) {
+    (void)arg;
+    fetch_task_t task;
+    if (!fetch_task_init(&task)) {
+        fprintf(stderr, "Thread %ld: curl_easy_init failed\n", pthread_self());
+        fetcher_failed();
+        return NULL;
+    }
+    
+    char *batch[POP_BATCH_MAX];
+    unsigned attempts[POP_BATCH_MAX];
+    unsigned batch_len = 0, batch_pos = 0;
+    
+    pthread_mutex_lock(&count_mutex);
+    active_threads++;
+    pthread_mutex_unlock(&count_mutex);
+    
+    while (!should_exit && !png_limit_reached()) {
+        // Refill the local batch only once it is used up
+        if (batch_pos == batch_len) {
+            batch_len = queue_pop_many(&frontier, batch, attempts, POP_BATCH_MAX, 1);
+            batch_pos = 0;
+            if (batch_len == 0) {
+                break;
+            }
+        }
+        unsigned i = batch_pos++;
+        if (!fetch_task_begin(&task, batch[i], attempts[i])) {
+            continue;
+        }
+        fetch_result_t fr;
+        fetch_url(task.curl, task.url, &task.resp, &task.hdr, &fr);
+        fetch_task_finish(&task, &fr);
+    }
+    
+    while (batch_pos < batch_len) {
+        free(batch[batch_pos++]);
+    }
+    fetch_task_cleanup(&task);
+    fetcher_exit();
+    return NULL;
+}
+
+// Task runtime (--tasks N): each thread multiplexes up to N fetches over one
+// curl multi handle. A fetch is a fetch_task_t that is parked while its socket
+// is not ready and resumed by curl_multi_perform, so concurrency costs a few
+// KB of task state rather than a thread stack per request.
+void *task_thread(void *arg) {
+    (void)arg;
+    CURLM *multi = multi_handle_get();
+    fetch_task_t *tasks = calloc(num_tasks, sizeof(*tasks));
+    fetch_task_t **idle = calloc(num_tasks, sizeof(*idle));
+    unsigned num_idle = 0;
+    if (multi && tasks && idle) {
+        for (unsigned i = 0; i < num_tasks; i++) {
+            if (!fetch_task_init(&tasks[i])) break;
+            idle[num_idle++] = &tasks[i];
+        }
+    }
+    if (num_idle == 0) {
+        // fetch_task_init cleans up after itself, nothing else is held
+        fprintf(stderr, "Thread %ld: task runtime setup failed\n", pthread_self());
+        fetcher_failed();
+        free(tasks);
+        free(idle);
+        if (multi) multi_handle_put(multi);
+        return NULL;
+    }
+    unsigned num_ready = num_idle;  // tasks successfully set up
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)num_ready);
+    
+    char *batch[POP_BATCH_MAX];
+    unsigned attempts[POP_BATCH_MAX];
+    unsigned batch_len = 0, batch_pos = 0;
+    unsigned in_flight = 0;
+    
+    pthread_mutex_lock(&count_mutex);
+    active_threads++;
+    pthread_mutex_unlock(&count_mutex);
+    
+    while (!should_exit && !png_limit_reached()) {
+        // Start fetches while there are parked tasks; only wait on the
+        // frontier when nothing is in flight, otherwise this thread is busy
+        int drained = 0;
+        while (num_idle > 0 && !should_exit) {
+            if (batch_pos == batch_len) {
+                batch_len = queue_pop_many(&frontier, batch, attempts, POP_BATCH_MAX, in_flight == 0);
+                batch_pos = 0;
+                if (batch_len == 0) {
+                    drained = in_flight == 0;
+                    break;
+                }
+            }
+            fetch_task_t *t = idle[num_idle - 1];
+            unsigned i = batch_pos++;
+            if (!fetch_task_begin(t, batch[i], attempts[i])) {
+                continue;
+            }
+            num_idle--;
+            curl_multi_add_handle(multi, t->curl);
+            in_flight++;
+        }
+        if (drained || should_exit) {
+            break;
+        }
+        if (in_flight == 0) {
+            continue;
+        }
+        
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURL *curl = msg->easy_handle;
+            CURLcode rc = msg->data.result;
+            fetch_task_t *t = NULL;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&t);
+            curl_multi_remove_handle(multi, curl);
+            
+            fetch_result_t fr;
+            fetch_done(curl, t->url, rc == CURLE_OK, &t->resp, &t->hdr, &fr);
+            fetch_task_finish(t, &fr);
+            idle[num_idle++] = t;
+            in_flight--;
+        }
+        // With parked tasks, come back soon to pick up URLs other threads push
+        if (in_flight > 0) {
+            curl_multi_poll(multi, NULL, 0, num_idle > 0 ? 10 : 1000, NULL);
+        }
+    }
+    
+    while (batch_pos < batch_len) {
+        free(batch[batch_pos++]);
+    }
+    for (unsigned i = 0; i < num_ready; i++) {
+        curl_multi_remove_handle(multi, tasks[i].curl);
+        fetch_task_cleanup(&tasks[i]);
+    }
+    multi_handle_put(multi);
+    free(tasks);
+    free(idle);
+    fetcher_exit();
+    return NULL;
+}
+
+// io_uring backend (--uring): plain http fetches go through a per-thread
+// uring_http client with one slot per task, everything else (https,
+// redirects, oversized or chunked responses) is fetched with curl inline.
+void *uring_thread(void *arg) {
+    uhttp_t *client = uhttp_create(num_tasks, RESP_KEEP_CAPACITY);
+    if (!client) {
+        fprintf(stderr, "Thread %ld: io_uring unavailable, using curl\n", pthread_self());
+        return task_thread(arg);
+    }
+    mem_charge((size_t)num_tasks * RESP_KEEP_CAPACITY);
+    fetch_task_t *tasks = calloc(num_tasks, sizeof(*tasks));
+    fetch_task_t **idle = calloc(num_tasks, sizeof(*idle));
+    unsigned num_idle = 0;
+    if (tasks && idle) {
+        for (unsigned i = 0; i < num_tasks; i++) {
+            if (!fetch_task_init(&tasks[i])) break;
+            idle[num_idle++] = &tasks[i];
+        }
+    }
+    unsigned num_ready = num_idle;
+    unsigned long via_curl = 0;
+    if (num_ready == 0) {
+        fprintf(stderr, "Thread %ld: task setup failed\n", pthread_self());
+        fetcher_failed();
+    }
+    
+    char *batch[POP_BATCH_MAX];
+    unsigned attempts[POP_BATCH_MAX];
+    unsigned batch_len = 0, batch_pos = 0;
+    unsigned in_flight = 0;
+    
+    pthread_mutex_lock(&count_mutex);
+    active_threads++;
+    pthread_mutex_unlock(&count_mutex);
+    
+    while (num_ready > 0 && !should_exit && !png_limit_reached()) {
+        int drained = 0;
+        while (num_idle > 0 && !should_exit) {
+            if (batch_pos == batch_len) {
+                batch_len = queue_pop_many(&frontier, batch, attempts, POP_BATCH_MAX, in_flight == 0);
+                batch_pos = 0;
+                if (batch_len == 0) {
+                    drained = in_flight == 0;
+                    break;
+                }
+            }
+            fetch_task_t *t = idle[num_idle - 1];
+            unsigned i = batch_pos++;
+            if (!fetch_task_begin(t, batch[i], attempts[i])) {
+                continue;
+            }
+            // Conditional request headers as raw header lines
+            char extra[2 * CACHE_VALUE_MAX + 64] = "";
+            size_t extra_len = 0;
+            for (struct curl_slist *h = t->cond_headers; h; h = h->next) {
+                int n = snprintf(extra + extra_len, sizeof(extra) - extra_len, "%s\r\n", h->data);
+                if (n > 0 && (size_t)n < sizeof(extra) - extra_len) extra_len += n;
+            }
+            long timeout = fetch_timeout_for(t->host, t->attempt);
+            if (uhttp_submit(client, t->url, extra, connect_timeout_ms, timeout, t)) {
+                num_idle--;
+                in_flight++;
+                continue;
+            }
+            fetch_result_t fr;
+            fetch_url(t->curl, t->url, &t->resp, &t->hdr, &fr);
+            fetch_task_finish(t, &fr);
+            via_curl++;
+        }
+        if (drained || should_exit) {
+            break;
+        }
+        if (in_flight == 0) {
+            continue;
+        }
+        
+        // With parked tasks, come back soon to pick up URLs other threads push
+        uhttp_result_t r;
+        for (int wait_ms = num_idle > 0 ? 10 : 1000; uhttp_wait(client, &r, wait_ms) > 0; wait_ms = 0) {
+            fetch_task_t *t = r.user;
+            fetch_result_t fr = { 0, r.status, NULL, 0, NULL };
+            if (r.outcome == UHTTP_OK) {
+                replay_headers(r.headers, r.hdr_len, &t->hdr);
+                fr.ok = 1;
+                fr.body = r.body;
+                fr.body_len = r.body_len;
+                if (record_file) {
+                    archive_record(t->url, r.status, r.headers, r.hdr_len, r.body, r.body_len);
+                }
+            } else if (r.outcome == UHTTP_FALLBACK) {
+                fetch_url(t->curl, t->url, &t->resp, &t->hdr, &fr);
+                via_curl++;
+            }
+            fetch_task_finish(t, &fr);
+            uhttp_recycle(client, r.slot);
+            idle[num_idle++] = t;
+            in_flight--;
+        }
+    }
+    
+    while (batch_pos < batch_len) {
+        free(batch[batch_pos++]);
+    }
+    uhttp_stats_t st;
+    uhttp_get_stats(client, &st);
+    uhttp_destroy(client);  // drops whatever was still in flight
+    mem_release((size_t)num_tasks * RESP_KEEP_CAPACITY);
+    for (unsigned i = 0; i < num_ready; i++) {
+        fetch_task_cleanup(&tasks[i]);
+    }
+    free(tasks);
+    free(idle);
+    
+    pthread_mutex_lock(&count_mutex);
+    uring_stats.requests += st.requests;
+    uring_stats.connects += st.connects;
+    uring_stats.reused += st.reused;
+    uring_stats.fallbacks += via_curl;
+    pthread_mutex_unlock(&count_mutex);
+    fetcher_exit();
+    return NULL;
+}
+
+// Worker side: apply messages from the coordinator
+void *part_receiver_thread(void *arg) {
+    (void)arg;
+    part_reader_t reader;
+    part_reader_init(&reader, part_fd);
+    char kind;
+    char payload[PART_LINE_MAX];
+    int quit = 0;
+
+    while (!quit && !should_exit && part_reader_fill(&reader)) {
+        while (part_reader_next(&reader, &kind, payload, sizeof(payload))) {
+            if (kind == 'U' && is_valid_url(payload)) {
+                if (!is_url_visited(payload)) {
+                    char *url = payload;
+                    queue_push_many(&frontier, &url, 1);
+                }
+                pthread_mutex_lock(&frontier_mutex);
+                part_recv_count++;
+                part_report_idle();
+                pthread_mutex_unlock(&frontier_mutex);
+            } else if (kind == 'Q') {
+                quit = 1;
+                break;
+            }
+        }
+    }
+
+    // Told to stop, or the coordinator went away
+    pthread_mutex_lock(&frontier_mutex);
+    should_exit = 1;
+    pthread_cond_broadcast(&frontier_not_empty);
+    pthread_mutex_unlock(&frontier_mutex);
+    return NULL;
+}
+
+// Start the parser pool, if any, and T fetcher threads and wait for them
+int run_fetchers(void) {
+    // Replayed responses never touch a socket, so there is nothing to multiplex
+    int use_tasks = num_tasks > 1 && !replay_file;
+    void *(*thread_fn)(void *) = use_uring && !replay_file ? uring_thread :
+                                 use_tasks ? task_thread : fetcher_thread;
+    pthread_t *threads = malloc((T + num_parsers) * sizeof(pthread_t));
+    if (!threads) {
+        perror("malloc threads");
+        return 0;
+    }
+    pthread_t *parsers = threads + T;
+    unsigned parsers_started = 0;
+    if (num_parsers > 0) {
+        if (!mpmc_init(&parse_queue, PARSE_QUEUE_CAPACITY) || sem_init(&parse_ready, 0, 0) != 0) {
+            perror("parse queue");
+            free(threads);
+            return 0;
+        }
+        parse_stop = 0;
+        parse_pending = parse_pending_peak = 0;
+        atomic_store(&stat_handed_off, 0);
+        atomic_store(&stat_handoff_ns, 0);
+        atomic_store(&stat_parsed, 0);
+        atomic_store(&stat_parse_ns, 0);
+        atomic_store(&stat_links, 0);
+        for (unsigned i = 0; i < num_parsers; i++) {
+            if (pthread_create(&parsers[i], NULL, parser_thread, NULL) != 0) {
+                perror("pthread_create parser");
+                break;
+            }
+            parsers_started++;
+        }
     }
-    
-    curl_easy_cleanup(curl);
-    free(resp.data);
-    
-    pthread_mutex_lock(&count_mutex);
-    active_threads--;
-    if (active_threads == 0 || png_count >= M) {
-        should_exit = 1;
+    unsigned long long start = now_ns();
+    int started = 0;
+    for (int i = 0; i < T && (num_parsers == 0 || parsers_started > 0); i++) {
+        if (pthread_create(&threads[i], NULL, thread_fn, NULL) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        started++;
+    }
+    if (started < T) {
+        // Let the threads that did start see an empty, finished crawl
         pthread_mutex_lock(&frontier_mutex);
+        should_exit = 1;
         pthread_cond_broadcast(&frontier_not_empty);
         pthread_mutex_unlock(&frontier_mutex);
     }
-    pthread_mutex_unlock(&count_mutex);
-    
-    return NULL;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double wall = (now_ns() - start) / 1e9;
+
+    if (num_parsers > 0) {
+        parse_stop = 1;
+        for (unsigned i = 0; i < parsers_started; i++) {
+            sem_post(&parse_ready);
+        }
+        for (unsigned i = 0; i < parsers_started; i++) {
+            pthread_join(parsers[i], NULL);
+        }
+        // Pages still queued when the crawl stopped early
+        parse_job_t *job;
+        while ((job = mpmc_pop(&parse_queue))) {
+            parse_job_free(job);
+        }
+        mpmc_destroy(&parse_queue);
+        sem_destroy(&parse_ready);
+
+        double parse_busy = atomic_load(&stat_parse_ns) / 1e9;
+        fprintf(stderr, "findpng2: fetch stage: %d threads x %u tasks, %lu pages handed off, "
+                "%.3f s waiting on a full parse queue\n",
+                T, num_tasks, atomic_load(&stat_handed_off), atomic_load(&stat_handoff_ns) / 1e9);
+        fprintf(stderr, "findpng2: parse stage: %u parsers, %lu pages, %lu links, %.3f s busy "
+                "(%.0f%% of %.3f s), peak %lu pages pending\n",
+                num_parsers, atomic_load(&stat_parsed), atomic_load(&stat_links), parse_busy,
+                wall > 0 ? 100.0 * parse_busy / (wall * num_parsers) : 0.0, wall, parse_pending_peak);
+    }
+    free(threads);
+    return started == T;
+}
+
+// Body of a forked worker process owning partition index
+int run_worker(unsigned index, int fd) {
+    part_index = index;
+    part_fd = fd;
+    signal(SIGPIPE, SIG_IGN);
+    // --mem-limit bounds the whole crawl, each worker gets its share
+    if (mem_limit) {
+        mem_limit = mem_limit / num_procs ? mem_limit / num_procs : 1;
+    }
+    // The exact tier's mapping is shared with the other workers, take a private one
+    if (visited_filter) {
+        cleanup_visited_hash_table();
+        if (!init_visited_hash_table()) return 1;
+    }
+
+    pthread_t sender, receiver;
+    if (pthread_create(&sender, NULL, part_sender_thread, NULL) != 0) {
+        perror("pthread_create sender");
+        return 1;
+    }
+    if (pthread_create(&receiver, NULL, part_receiver_thread, NULL) != 0) {
+        perror("pthread_create receiver");
+        part_out_closed = 1;  // the sender has nothing queued yet
+        pthread_cond_signal(&part_out_ready);
+        pthread_join(sender, NULL);
+        return 1;
+    }
+    int ok = run_fetchers();
+    report_dedup();
+    report_retries();
+    report_visited();
+    report_scope();
+    report_verify();
+    // Let the last PNGs and idle report out before hanging up
+    pthread_mutex_lock(&part_out_mutex);
+    part_out_closed = 1;
+    pthread_cond_signal(&part_out_ready);
+    pthread_mutex_unlock(&part_out_mutex);
+    pthread_join(sender, NULL);
+    part_outbuf_free(&part_out);
+    shutdown(fd, SHUT_RDWR);  // unblocks the receiver if it is still reading
+    pthread_join(receiver, NULL);
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+// Queue a message for worker k, to be written once poll says it fits
+int coord_post(part_outbuf_t *out, struct pollfd *pfds, unsigned k, char kind, const char *payload) {
+    if (pfds[k].fd < 0 || !part_outbuf_put(&out[k], kind, payload)) return 0;
+    pfds[k].events |= POLLOUT;
+    return 1;
+}
+
+// Fork num_procs workers, route cross-partition URLs between them and
+// aggregate PNG results until M is reached or every worker is idle with
+// nothing in flight. Writes to workers never block: each has an output
+// buffer that is flushed as its socket has room, so the coordinator keeps
+// reading even when a worker is slow to.
+int run_coordinator(void) {
+    signal(SIGPIPE, SIG_IGN);
+    int *fds = calloc(num_procs, sizeof(int));
+    pid_t *pids = calloc(num_procs, sizeof(pid_t));
+    unsigned long *sent = calloc(num_procs, sizeof(unsigned long));
+    unsigned long *idle_at = calloc(num_procs, sizeof(unsigned long));  // recv count of last idle report + 1
+    part_reader_t *readers = calloc(num_procs, sizeof(part_reader_t));
+    part_outbuf_t *out = calloc(num_procs, sizeof(part_outbuf_t));
+    struct pollfd *pfds = calloc(num_procs, sizeof(struct pollfd));
+    if (!fds || !pids || !sent || !idle_at || !readers || !out || !pfds) {
+        perror("calloc coordinator");
+        free(fds); free(pids); free(sent); free(idle_at); free(readers); free(out); free(pfds);
+        return 0;
+    }
+
+    fflush(NULL);  // nothing buffered may be written twice by the children
+    unsigned forked = 0;
+    for (; forked < num_procs; forked++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            perror("socketpair");
+            break;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+        if (pid == 0) {
+            close(sv[0]);
+            for (unsigned j = 0; j < forked; j++) close(fds[j]);
+            _exit(run_worker(forked, sv[1]));
+        }
+        close(sv[1]);
+        fds[forked] = sv[0];
+        pids[forked] = pid;
+        part_reader_init(&readers[forked], sv[0]);
+        pfds[forked].fd = sv[0];
+        pfds[forked].events = POLLIN;
+    }
+
+    int ok = forked == num_procs;
+    if (ok) {
+        unsigned owner = partition_of(start_url, num_procs);
+        ok = coord_post(out, pfds, owner, 'U', start_url);
+        sent[owner]++;
+    }
+
+    unsigned alive = forked;
+    char kind;
+    char payload[PART_LINE_MAX];
+    while (ok && alive > 0 && png_count < M) {
+        if (poll(pfds, forked, -1) < 0) {
+            continue;  // EINTR
+        }
+        for (unsigned k = 0; k < forked; k++) {
+            if (pfds[k].revents & POLLOUT) {
+                if (!part_outbuf_flush(&out[k], fds[k], 0)) {
+                    pfds[k].events &= ~POLLOUT;  // the read side sees it go
+                } else if (out[k].len == 0) {
+                    pfds[k].events &= ~POLLOUT;
+                }
+            }
+            if (!(pfds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if (!part_reader_fill(&readers[k])) {
+                pfds[k].fd = -1;  // worker exited
+                alive--;
+                continue;
+            }
+            while (part_reader_next(&readers[k], &kind, payload, sizeof(payload))) {
+                if (kind == 'U') {
+                    unsigned owner = partition_of(payload, num_procs);
+                    if (coord_post(out, pfds, owner, 'U', payload)) {
+                        sent[owner]++;
+                    }
+                } else if (kind == 'P' && png_count < M) {
+                    fprintf(png_urls_fp, "%s\n", payload);
+                    fflush(png_urls_fp);
+                    png_count++;
+                    printf("Worker %u: Found PNG %s (%d/%d)\n", k, payload, png_count, M);
+                } else if (kind == 'I') {
+                    idle_at[k] = strtoul(payload, NULL, 10) + 1;
+                }
+            }
+        }
+
+        // Done when every worker is idle and has received all we sent it
+        unsigned quiet = 0;
+        for (unsigned k = 0; k < forked; k++) {
+            if (pfds[k].fd < 0 || idle_at[k] == sent[k] + 1) quiet++;
+        }
+        if (quiet == forked) break;
+    }
+
+    // URLs still queued for a worker are moot now, only the stop goes out
+    for (unsigned k = 0; k < forked; k++) {
+        out[k].len = 0;
+        part_outbuf_put(&out[k], 'Q', NULL);
+        part_outbuf_flush(&out[k], fds[k], 1);
+        part_outbuf_free(&out[k]);
+        close(fds[k]);
+    }
+    for (unsigned k = 0; k < forked; k++) {
+        waitpid(pids[k], NULL, 0);
+    }
+
+    free(fds); free(pids); free(sent); free(idle_at); free(readers); free(out); free(pfds);
+    return ok;
+}
+
+// Crawl from seed with the current T and M. Per-crawl state is reset first so
+// a daemon can run one job after another in the same process.
+int run_crawl(const char *seed) {
+    size_t seed_len = strlen(seed);
+    if (seed_len >= URL_MAX_LEN) {
+        fprintf(stderr, "Seed URL too long\n");
+        return 0;
+    }
+    start_url = (char *)seed;
+    png_count = 0;
+    should_exit = 0;
+    active_threads = 0;
+    idle_threads = 0;
+    frontier_init(&frontier);
+    frontier_peak = 0;
+    frontier_peak_url_bytes = 0;
+
+    int ok;
+    if (num_procs > 1) {
+        // The coordinator hands the seed to the worker owning its host
+        ok = run_coordinator();
+    } else {
+        char *seed_url = (char *)seed;
+        queue_push_many(&frontier, &seed_url, 1);
+        if (frontier.count == 0) {
+            frontier_destroy(&frontier);
+            return 0;
+        }
+        ok = run_fetchers();
+    }
+
+    mem_release(frontier_bytes);
+    frontier_bytes = 0;
+    frontier_destroy(&frontier);
+    if (spill_fp) {
+        fclose(spill_fp);
+        spill_fp = NULL;
+    }
+    spill_read_off = spill_write_off = 0;
+    spill_pending = 0;
+    retry_clear();
+    return ok;
+}
+
+// Curl share lock callbacks, one mutex per kind of shared data
+void share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle; (void)access; (void)userptr;
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+void share_unlock_cb(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle; (void)userptr;
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+// Serve crawl jobs on a Unix domain socket, one at a time. A job is the line
+//   CRAWL <T> <M> <output path> <seed url>
+// and is answered with one "PNG <url>" line per PNG as it is found, then
+//   DONE <count> <seconds>    or    ERR <reason>
+// The line SHUTDOWN stops the daemon.
+int run_daemon(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0) {
+        perror("socket");
+        return 1;
+    }
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 8) != 0) {
+        perror("bind/listen");
+        close(lfd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&share_locks[i], NULL);
+    }
+    curl_share = curl_share_init();
+    if (curl_share) {
+        curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+        curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    keep_handles = 1;
+
+    int running = 1;
+    while (running) {
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        FILE *in = fdopen(dup(cfd), "r");
+        char *line = NULL;
+        size_t cap = 0;
+        char out_path[PATH_MAX];
+        char seed[URL_MAX_LEN];
+        int t, m;
+
+        if (!in || getline(&line, &cap, in) <= 0) {
+            // client went away before sending a job
+        } else if (strncmp(line, "SHUTDOWN", 8) == 0) {
+            running = 0;
+        } else if (sscanf(line, "CRAWL %d %d %4095s %2047s", &t, &m, out_path, seed) != 4 ||
+                   t <= 0 || m <= 0 || !is_valid_url(seed)) {
+            dprintf(cfd, "ERR bad request\n");
+        } else if (!(png_urls_fp = fopen(out_path, "w"))) {
+            dprintf(cfd, "ERR cannot open %s\n", out_path);
+        } else {
+            T = t;
+            M = m;
+            // A filter cannot forget a URL, so only the exact table is kept
+            if (keep_visited && !visited_filter) {
+                visited_generation++;
+            } else {
+                cleanup_visited_hash_table();
+                init_visited_hash_table();
+            }
+            fp_set_clear();  // a page seen last job must still be parsed for its links
+            struct timeval start, end;
+            gettimeofday(&start, NULL);
+            job_fd = cfd;
+            int ok = run_crawl(seed);
+            job_fd = -1;
+            gettimeofday(&end, NULL);
+            fclose(png_urls_fp);
+            png_urls_fp = NULL;
+            double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+            if (ok) {
+                dprintf(cfd, "DONE %d %.6f\n", png_count, secs);
+            } else {
+                dprintf(cfd, "ERR crawl failed\n");
+            }
+        }
+        free(line);
+        if (in) fclose(in);
+        close(cfd);
+    }
+
+    close(lfd);
+    unlink(path);
+    keep_handles = 0;
+    for (size_t i = 0; i < warm_easy.count; i++) {
+        curl_easy_cleanup(warm_easy.handles[i]);  // before the share they use
+    }
+    for (size_t i = 0; i < warm_multi.count; i++) {
+        curl_multi_cleanup(warm_multi.handles[i]);
+    }
+    free(warm_easy.handles);
+    free(warm_multi.handles);
+    memset(&warm_easy, 0, sizeof(warm_easy));
+    memset(&warm_multi, 0, sizeof(warm_multi));
+    if (curl_share) {
+        curl_share_cleanup(curl_share);
+        curl_share = NULL;
+    }
+    return 0;
+}
+
+// Submit one crawl to a daemon and print its results like a local run
+int run_client(const char *path, const char *seed) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect to daemon");
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    // The daemon has its own working directory, hand it an absolute path
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd) - 16)) {
+        perror("getcwd");
+        close(fd);
+        return 1;
+    }
+    dprintf(fd, "CRAWL %d %d %s/png_urls.txt %s\n", T, M, cwd, seed);
+
+    FILE *in = fdopen(fd, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    int found = 0, rc = 1;
+    while (in && getline(&line, &cap, in) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "PNG ", 4) == 0) {
+            printf("Found PNG %s (%d/%d)\n", line + 4, ++found, M);
+        } else if (strncmp(line, "DONE ", 5) == 0) {
+            rc = 0;
+            break;
+        } else if (strncmp(line, "ERR ", 4) == 0) {
+            fprintf(stderr, "findpng2 daemon: %s\n", line + 4);
+            break;
+        }
+    }
+    free(line);
+    if (in) fclose(in);
+    if (rc != 0) return rc;
+
+    gettimeofday(&end, NULL);
+    double time_spent = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    printf("findpng2 execution time: %.6f seconds\n", time_spent);
+    return 0;
 }
 
 void cleanup_resources() {
@@ -544,19 +2469,111 @@ void cleanup_resources() {
     pthread_mutex_destroy(&visited_mutex);
     pthread_cond_destroy(&frontier_not_empty);
     cleanup_visited_hash_table();
+    fp_set_destroy();
+    hosts_destroy();
+    scope_destroy(&crawl_scope);
 }
 
 void usage(const char *prog) {
-    fprintf(stderr, "Usage: %s [-t T] [-m M] [-v logfile] URL\n", prog);
-    fprintf(stderr, "  -t T        Number of threads (default: 1)\n");
-    fprintf(stderr, "  -m M        Max number of PNGs to find (default: 50)\n");
-    fprintf(stderr, "  -v logfile  Log visited URLs to file (optional)\n");
-    fprintf(stderr, "  URL         Starting URL to crawl\n");
+    fprintf(stderr, "Usage: %s [-t T] [-m M] [-v logfile] [--cache DIR] [--record FILE | --replay FILE] URL\n", prog);
+    fprintf(stderr, "  -t T         Number of threads (default: 1)\n");
+    fprintf(stderr, "  -m M         Max number of PNGs to find (default: 50)\n");
+    fprintf(stderr, "  -v logfile   Log visited URLs to file (optional)\n");
+    fprintf(stderr, "  --cache DIR  Revalidate pages against an on-disk cache (optional)\n");
+    fprintf(stderr, "  --record FILE  Record every response into an archive (optional)\n");
+    fprintf(stderr, "  --replay FILE  Serve fetches from a recorded archive instead of the network\n");
+    fprintf(stderr, "  --replay-latency MS  Simulated latency per replayed fetch (default: 0)\n");
+    fprintf(stderr, "  --mem-limit SIZE  Memory budget for frontier, visited set and buffers, e.g. 64M\n");
+    fprintf(stderr, "  --procs N    Crawl with N worker processes, hosts hash-partitioned (default: 1)\n");
+    fprintf(stderr, "  --tasks N    Concurrent fetches multiplexed on each thread (default: 1)\n");
+    fprintf(stderr, "  --uring      Fetch plain http with the io_uring client, curl for the rest\n");
+    fprintf(stderr, "  --parsers P  Parse pages on P separate threads (default: 0, parse on the fetcher)\n");
+    fprintf(stderr, "  --dedup      Skip parsing pages whose content was already seen\n");
+    fprintf(stderr, "  --verify     Count a PNG only if its chunks, CRCs and image data check out\n");
+    fprintf(stderr, "  --timeout MS Fetch timeout before a host has a latency history (default: 10000)\n");
+    fprintf(stderr, "  --connect-timeout MS  Connect timeout (default: 3000)\n");
+    fprintf(stderr, "  --retries N  Retries of a failed fetch, with backoff (default: 2)\n");
+    fprintf(stderr, "  --daemon SOCK  Serve crawl jobs on a Unix socket, keeping connections warm\n");
+    fprintf(stderr, "  --keep-visited Keep the exact visited table across daemon jobs instead of\n"
+                    "               rebuilding it; each job still fetches every page it reaches\n");
+    fprintf(stderr, "  --visited-mode exact|bloom|tiered  Visited set: every URL, a Bloom filter, or a Bloom\n"
+                    "               filter in front of a file backed exact set (default: exact)\n");
+    fprintf(stderr, "  --expected-urls N  URLs the bloom and tiered filters are sized for, e.g. 100M (default: 1000000)\n");
+    fprintf(stderr, "  --fp-rate P  Bloom filter false positive budget (default: 0.001)\n");
+    fprintf(stderr, "  --allow-domain D,...  Crawl only these domains and their subdomains\n");
+    fprintf(stderr, "  --deny-domain D,...   Skip these domains and their subdomains\n");
+    fprintf(stderr, "  --allow-path P,...    Crawl only paths under these prefixes\n");
+    fprintf(stderr, "  --deny-path P,...     Skip paths under these prefixes; the most specific domain\n"
+                    "               or path rule wins\n");
+    fprintf(stderr, "  --deny-ext E,...      Skip links to files with these extensions, e.g. pdf,zip\n");
+    fprintf(stderr, "  --max-depth N  Skip links with more than N path segments (default: 0, no limit)\n");
+    fprintf(stderr, "  --submit SOCK  Run the crawl on a daemon listening on SOCK\n");
+    fprintf(stderr, "  URL          Starting URL to crawl\n");
+}
+
+// Long-only options
+enum { OPT_CACHE = 256, OPT_RECORD, OPT_REPLAY, OPT_REPLAY_LATENCY, OPT_MEM_LIMIT, OPT_PROCS,
+       OPT_DAEMON, OPT_KEEP_VISITED, OPT_SUBMIT, OPT_TASKS,
+       OPT_URING, OPT_PARSERS, OPT_DEDUP, OPT_TIMEOUT, OPT_CONNECT_TIMEOUT, OPT_RETRIES,
+       OPT_VISITED_MODE, OPT_EXPECTED_URLS, OPT_FP_RATE, OPT_ALLOW_DOMAIN, OPT_DENY_DOMAIN,
+       OPT_ALLOW_PATH, OPT_DENY_PATH, OPT_DENY_EXT, OPT_MAX_DEPTH,
+       OPT_VERIFY };
+
+// Add a comma separated list of scope rules of one kind, 1 on success
+int add_scope_rules(int opt, const char *list) {
+    char *copy = strdup(list);
+    if (!copy) return 0;
+    int ok = 1;
+    char *save = NULL;
+    for (char *rule = strtok_r(copy, ",", &save); rule && ok; rule = strtok_r(NULL, ",", &save)) {
+        switch (opt) {
+            case OPT_ALLOW_DOMAIN: ok = scope_add_domain(&crawl_scope, rule, 1); break;
+            case OPT_DENY_DOMAIN:  ok = scope_add_domain(&crawl_scope, rule, 0); break;
+            case OPT_ALLOW_PATH:   ok = scope_add_path(&crawl_scope, rule, 1); break;
+            case OPT_DENY_PATH:    ok = scope_add_path(&crawl_scope, rule, 0); break;
+            default:               ok = scope_add_ext(&crawl_scope, rule); break;
+        }
+    }
+    free(copy);
+    return ok;
 }
 
+static const struct option long_options[] = {
+    { "cache", required_argument, NULL, OPT_CACHE },
+    { "record", required_argument, NULL, OPT_RECORD },
+    { "replay", required_argument, NULL, OPT_REPLAY },
+    { "replay-latency", required_argument, NULL, OPT_REPLAY_LATENCY },
+    { "mem-limit", required_argument, NULL, OPT_MEM_LIMIT },
+    { "procs", required_argument, NULL, OPT_PROCS },
+    { "daemon", required_argument, NULL, OPT_DAEMON },
+    { "keep-visited", no_argument, NULL, OPT_KEEP_VISITED },
+    { "submit", required_argument, NULL, OPT_SUBMIT },
+    { "tasks", required_argument, NULL, OPT_TASKS },
+    { "uring", no_argument, NULL, OPT_URING },
+    { "parsers", required_argument, NULL, OPT_PARSERS },
+    { "dedup", no_argument, NULL, OPT_DEDUP },
+    { "timeout", required_argument, NULL, OPT_TIMEOUT },
+    { "connect-timeout", required_argument, NULL, OPT_CONNECT_TIMEOUT },
+    { "retries", required_argument, NULL, OPT_RETRIES },
+    { "visited-mode", required_argument, NULL, OPT_VISITED_MODE },
+    { "expected-urls", required_argument, NULL, OPT_EXPECTED_URLS },
+    { "fp-rate", required_argument, NULL, OPT_FP_RATE },
+    { "verify", no_argument, NULL, OPT_VERIFY },
+    { "allow-domain", required_argument, NULL, OPT_ALLOW_DOMAIN },
+    { "deny-domain", required_argument, NULL, OPT_DENY_DOMAIN },
+    { "allow-path", required_argument, NULL, OPT_ALLOW_PATH },
+    { "deny-path", required_argument, NULL, OPT_DENY_PATH },
+    { "deny-ext", required_argument, NULL, OPT_DENY_EXT },
+    { "max-depth", required_argument, NULL, OPT_MAX_DEPTH },
+    { "help",  no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char *argv[]) {
+    char *daemon_path = NULL;
+    char *submit_path = NULL;
     int opt;
-    while ((opt = getopt(argc, argv, "t:m:v:h")) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:m:v:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 't':
                 T = atoi(optarg);
@@ -577,6 +2594,145 @@ int main(int argc, char *argv[]) {
             case 'v':
                 log_file = optarg;
                 break;
+            case OPT_CACHE:
+                cache_dir = optarg;
+                break;
+            case OPT_RECORD:
+                record_file = optarg;
+                break;
+            case OPT_REPLAY:
+                replay_file = optarg;
+                break;
+            case OPT_REPLAY_LATENCY:
+                replay_latency_ms = atol(optarg);
+                if (replay_latency_ms < 0) {
+                    fprintf(stderr, "Error: invalid --replay-latency <ms>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_MEM_LIMIT:
+                mem_limit = parse_size(optarg);
+                if (mem_limit == 0) {
+                    fprintf(stderr, "Error: invalid --mem-limit <size>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_PROCS:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: invalid --procs <n>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                num_procs = atoi(optarg);
+                break;
+            case OPT_TASKS:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: invalid --tasks <n>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                num_tasks = atoi(optarg);
+                break;
+            case OPT_PARSERS:
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Error: invalid --parsers <n>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                num_parsers = atoi(optarg);
+                break;
+            case OPT_DEDUP:
+                dedup = 1;
+                break;
+            case OPT_VERIFY:
+                verify_pngs = 1;
+                break;
+            case OPT_TIMEOUT:
+                fetch_timeout_ms = atol(optarg);
+                if (fetch_timeout_ms <= 0) {
+                    fprintf(stderr, "Error: invalid --timeout <ms>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_CONNECT_TIMEOUT:
+                connect_timeout_ms = atol(optarg);
+                if (connect_timeout_ms <= 0) {
+                    fprintf(stderr, "Error: invalid --connect-timeout <ms>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_VISITED_MODE:
+                if (strcmp(optarg, "exact") == 0) {
+                    visited_mode = VISITED_EXACT;
+                } else if (strcmp(optarg, "bloom") == 0) {
+                    visited_mode = VISITED_BLOOM;
+                } else if (strcmp(optarg, "tiered") == 0) {
+                    visited_mode = VISITED_TIERED;
+                } else {
+                    fprintf(stderr, "Error: invalid --visited-mode <exact|bloom|tiered>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_EXPECTED_URLS:
+                expected_urls = parse_size(optarg);
+                if (expected_urls == 0) {
+                    fprintf(stderr, "Error: invalid --expected-urls <n>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_FP_RATE:
+                visited_fp_rate = atof(optarg);
+                if (visited_fp_rate <= 0 || visited_fp_rate >= 1) {
+                    fprintf(stderr, "Error: invalid --fp-rate <p>, must be between 0 and 1\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_ALLOW_DOMAIN:
+            case OPT_DENY_DOMAIN:
+            case OPT_ALLOW_PATH:
+            case OPT_DENY_PATH:
+            case OPT_DENY_EXT:
+                if (!add_scope_rules(opt, optarg)) {
+                    fprintf(stderr, "Error: invalid scope rule '%s' (paths must start with '/')\n", optarg);
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_MAX_DEPTH:
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Error: invalid --max-depth <n>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                scope_set_max_depth(&crawl_scope, (unsigned)atoi(optarg));
+                break;
+            case OPT_RETRIES:
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Error: invalid --retries <n>\n");
+                    usage(argv[0]);
+                    return 1;
+                }
+                max_retries = atoi(optarg);
+                break;
+            case OPT_URING:
+                use_uring = 1;
+                break;
+            case OPT_DAEMON:
+                daemon_path = optarg;
+                break;
+            case OPT_KEEP_VISITED:
+                keep_visited = 1;
+                break;
+            case OPT_SUBMIT:
+                submit_path = optarg;
+                break;
             case 'h':
             default:
                 usage(argv[0]);
@@ -584,15 +2740,46 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    if (optind >= argc) {
+    if (daemon_path && (num_procs > 1 || submit_path)) {
+        fprintf(stderr, "Error: --daemon cannot be combined with --procs or --submit\n");
+        return 1;
+    }
+    
+    if (optind >= argc && !daemon_path) {
         fprintf(stderr, "Error: missing start URL\n");
         usage(argv[0]);
         return 1;
     }
     
-    start_url = argv[optind];
-    if (!is_valid_url(start_url)) {
-        fprintf(stderr, "Error: Invalid start URL: %s\n", start_url);
+    if (optind < argc) {
+        start_url = argv[optind];
+        if (!is_valid_url(start_url)) {
+            fprintf(stderr, "Error: Invalid start URL: %s\n", start_url);
+            return 1;
+        }
+    }
+    
+    if (submit_path) {
+        return run_client(submit_path, start_url);
+    }
+    
+    if (cache_dir && !cache_open(cache_dir)) {
+        fprintf(stderr, "Error: cannot open cache directory %s\n", cache_dir);
+        return 1;
+    }
+    
+    if (record_file && replay_file) {
+        fprintf(stderr, "Error: --record and --replay are mutually exclusive\n");
+        return 1;
+    }
+    if (record_file && num_procs > 1) {
+        fprintf(stderr, "Error: --record cannot be combined with --procs\n");
+        return 1;
+    }
+    if (record_file && !archive_record_open(record_file)) {
+        return 1;
+    }
+    if (replay_file && !archive_replay_open(replay_file)) {
         return 1;
     }
     
@@ -605,7 +2792,14 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    queue_init(&frontier_list, INITIAL_LIST_CAPACITY);
+    if (daemon_path) {
+        int rc = run_daemon(daemon_path);
+        archive_record_close();
+        archive_replay_close();
+        cleanup_resources();
+        curl_global_cleanup();
+        return rc;
+    }
     
     png_urls_fp = fopen("png_urls.txt", "w");
     if (!png_urls_fp) {
@@ -629,21 +2823,7 @@ int main(int argc, char *argv[]) {
     struct timeval start, end;
     gettimeofday(&start, NULL);
     
-    pthread_t *threads = malloc(T * sizeof(pthread_t));
-    if (!threads) {
-        perror("malloc threads");
-        fclose(png_urls_fp);
-        if (log_fp) fclose(log_fp);
-        cleanup_resources();
-        curl_global_cleanup();
-        return 1;
-    }
-    
-    // Add seed URL to frontier
-    size_t seed_len = strlen(start_url);
-    if (seed_len >= URL_MAX_LEN) {
-        fprintf(stderr, "Seed URL too long\n");
-        free(threads);
+    if (!run_crawl(start_url)) {
         fclose(png_urls_fp);
         if (log_fp) fclose(log_fp);
         cleanup_resources();
@@ -651,43 +2831,32 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    char *seed_url = malloc(seed_len + 1);
-    if (!seed_url) {
-        fprintf(stderr, "malloc failed for seed URL\n");
-        free(threads);
-        fclose(png_urls_fp);
-        if (log_fp) fclose(log_fp);
-        cleanup_resources();
-        curl_global_cleanup();
-        return 1;
-    }
-    memcpy(seed_url, start_url, seed_len + 1);
-    queue_push(&frontier_list, seed_url);
+    gettimeofday(&end, NULL);
+    double time_spent = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
     
-    // Create threads
-    for (int i = 0; i < T; i++) {
-        if (pthread_create(&threads[i], NULL, fetcher_thread, NULL) != 0) {
-            perror("pthread_create");
-            free(threads);
-            fclose(png_urls_fp);
-            if (log_fp) fclose(log_fp);
-            cleanup_resources();
-            curl_global_cleanup();
-            return 1;
+    if (num_procs <= 1) {
+        report_dedup();  // partitioned workers report their own
+        report_retries();
+        report_visited();
+        report_scope();
+        report_verify();
+        if (atomic_load(&stat_redirected)) {
+            fprintf(stderr, "findpng2: %lu fetches redirected, %lu of them to an already fetched page\n",
+                    atomic_load(&stat_redirected), atomic_load(&stat_aliases));
         }
     }
-    
-    // Wait for threads to complete
-    for (int i = 0; i < T; i++) {
-        pthread_join(threads[i], NULL);
+    if (use_uring) {
+        fprintf(stderr, "findpng2: io_uring sent %lu requests on %lu connections (%lu reused), %lu via curl\n",
+                uring_stats.requests, uring_stats.connects, uring_stats.reused, uring_stats.fallbacks);
     }
-    
-    free(threads);
-    
-    gettimeofday(&end, NULL);
-    double time_spent = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
-    
-    queue_destroy(&frontier_list);
+    if (mem_limit) {
+        fprintf(stderr, "findpng2: peak tracked memory %zu of %zu bytes, %lu URLs spilled\n",
+                atomic_load(&mem_peak), mem_limit, spill_total);
+        fprintf(stderr, "findpng2: frontier peak %zu bytes of blocks for %llu bytes of URL strings\n",
+                frontier_peak, frontier_peak_url_bytes);
+    }
+    archive_record_close();
+    archive_replay_close();
     cleanup_resources();
     curl_global_cleanup();
     
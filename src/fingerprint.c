@@ -0,0 +1,199 @@
+/**
+ * @file: fingerprint.c
+ * @brief: XXH64 and a sharded fingerprint set, see fingerprint.h
+ *
+ * The set has FP_SHARDS open addressing tables of fingerprints; the top bits
+ * of a fingerprint pick the shard and the low bits the slot. 0 marks an empty
+ * slot, so a fingerprint of 0 is stored as 1.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "fingerprint.h"
+
+#define FP_SHARD_BITS 6
+#define FP_SHARDS (1u << FP_SHARD_BITS)
+#define FP_SHARD_INITIAL 256  // slots per shard on first use
+
+#define P64_1 0x9E3779B185EBCA87ULL
+#define P64_2 0xC2B2AE3D27D4EB4FULL
+#define P64_3 0x165667B19E3779F9ULL
+#define P64_4 0x85EBCA77C2B2AE63ULL
+#define P64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian reads; the hash is only compared within one process
+static uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * P64_2;
+    acc = rotl64(acc, 31);
+    return acc * P64_1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * P64_1 + P64_4;
+}
+
+uint64_t fp_hash64(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + P64_1 + P64_2;
+        uint64_t v2 = seed + P64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P64_1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + P64_5;
+    }
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * P64_1 + P64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * P64_1;
+        h = rotl64(h, 23) * P64_2 + P64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * P64_5;
+        h = rotl64(h, 11) * P64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= P64_2;
+    h ^= h >> 29;
+    h *= P64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t *slots;
+    size_t capacity;  // power of two
+    size_t count;
+} fp_shard_t;
+
+static fp_shard_t shards[FP_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void shards_init(void) {
+    for (unsigned k = 0; k < FP_SHARDS; k++) {
+        pthread_mutex_init(&shards[k].lock, NULL);
+    }
+}
+
+static void shard_put(uint64_t *slots, size_t mask, uint64_t fp) {
+    size_t i = fp & mask;
+    while (slots[i]) i = (i + 1) & mask;
+    slots[i] = fp;
+}
+
+// Double the shard's table, or create it; 0 on allocation failure
+static int shard_grow(fp_shard_t *s, size_t *grown) {
+    size_t capacity = s->capacity ? s->capacity * 2 : FP_SHARD_INITIAL;
+    uint64_t *slots = calloc(capacity, sizeof(uint64_t));
+    if (!slots) return 0;
+    for (size_t i = 0; i < s->capacity; i++) {
+        if (s->slots[i]) shard_put(slots, capacity - 1, s->slots[i]);
+    }
+    *grown += (capacity - s->capacity) * sizeof(uint64_t);
+    free(s->slots);
+    s->slots = slots;
+    s->capacity = capacity;
+    return 1;
+}
+
+int fp_set_insert(uint64_t fp, size_t *grown) {
+    *grown = 0;
+    if (fp == 0) fp = 1;
+    pthread_once(&shards_once, shards_init);
+    fp_shard_t *s = &shards[fp >> (64 - FP_SHARD_BITS)];
+
+    pthread_mutex_lock(&s->lock);
+    // Keep the load under one half so probe runs stay short
+    if ((s->count + 1) * 2 > s->capacity && !shard_grow(s, grown) && s->count + 1 >= s->capacity) {
+        pthread_mutex_unlock(&s->lock);
+        return 1;  // out of memory and full: treat as new, never drop a page
+    }
+    size_t mask = s->capacity - 1;
+    size_t i = fp & mask;
+    while (s->slots[i]) {
+        if (s->slots[i] == fp) {
+            pthread_mutex_unlock(&s->lock);
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    s->slots[i] = fp;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+    return 1;
+}
+
+void fp_set_clear(void) {
+    pthread_once(&shards_once, shards_init);
+    for (unsigned k = 0; k < FP_SHARDS; k++) {
+        pthread_mutex_lock(&shards[k].lock);
+        if (shards[k].slots) memset(shards[k].slots, 0, shards[k].capacity * sizeof(uint64_t));
+        shards[k].count = 0;
+        pthread_mutex_unlock(&shards[k].lock);
+    }
+}
+
+void fp_set_destroy(void) {
+    pthread_once(&shards_once, shards_init);
+    for (unsigned k = 0; k < FP_SHARDS; k++) {
+        pthread_mutex_lock(&shards[k].lock);
+        free(shards[k].slots);
+        shards[k].slots = NULL;
+        shards[k].capacity = shards[k].count = 0;
+        pthread_mutex_unlock(&shards[k].lock);
+    }
+}
+
+size_t fp_set_bytes(void) {
+    size_t total = 0;
+    pthread_once(&shards_once, shards_init);
+    for (unsigned k = 0; k < FP_SHARDS; k++) {
+        pthread_mutex_lock(&shards[k].lock);
+        total += shards[k].capacity * sizeof(uint64_t);
+        pthread_mutex_unlock(&shards[k].lock);
+    }
+    return total;
+}
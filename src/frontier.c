@@ -0,0 +1,276 @@
+/**
+ * @file: frontier.c
+ * @brief: block based, front-coded URL stack, see frontier.h
+ *
+ * A record is three unsigned LEB128 varints followed by the suffix bytes:
+ *
+ *   tag     host id << 2 | scheme (0 whole URL as path, 1 http, 2 https)
+ *   shared  bytes of path shared with the previous record, 0 at a restart
+ *   length  bytes of path stored in this record
+ *
+ * URLs whose host is not already in canonical (lowercase) form are stored
+ * whole with scheme 0 so they come back byte for byte.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "frontier.h"
+#include "hosts.h"
+
+enum { SCHEME_RAW, SCHEME_HTTP, SCHEME_HTTPS };
+
+static const char *scheme_prefix[] = { "", "http://", "https://" };
+
+// Header bytes of a block as written to a spill file, data follows
+#define BLOCK_HEADER offsetof(frontier_block_t, data)
+
+static size_t varint_put(unsigned char *p, unsigned long v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static size_t varint_len(unsigned long v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static unsigned long varint_get(const unsigned char **p) {
+    unsigned long v = 0;
+    unsigned shift = 0;
+    while (**p & 0x80) {
+        v |= (unsigned long)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= (unsigned long)(*(*p)++) << shift;
+    return v;
+}
+
+// Split url into scheme, host id and the path after the host
+static unsigned long url_tag(const char *url, const char **path) {
+    int scheme = strncmp(url, "http://", 7) == 0 ? SCHEME_HTTP :
+                 strncmp(url, "https://", 8) == 0 ? SCHEME_HTTPS : SCHEME_RAW;
+    if (scheme != SCHEME_RAW) {
+        const char *host = url + strlen(scheme_prefix[scheme]);
+        size_t len = strcspn(host, "/?#");
+        unsigned id = host_intern_n(host, len);
+        const char *key = id == HOST_NONE ? NULL : host_key(id);
+        if (key && strncmp(key, host, len) == 0) {
+            *path = host + len;
+            return (unsigned long)id << 2 | scheme;
+        }
+    }
+    *path = url;
+    return SCHEME_RAW;
+}
+
+// What the URLs in b would take as C strings
+static unsigned long long block_url_bytes(const frontier_block_t *b) {
+    unsigned long long bytes = 0;
+    const unsigned char *p = b->data;
+    const unsigned char *end = b->data + b->used;
+    while (p < end) {
+        unsigned long tag = varint_get(&p);
+        size_t shared = varint_get(&p);
+        size_t len = varint_get(&p);
+        p += len;
+        const char *host = (tag & 3) == SCHEME_RAW ? NULL : host_key((unsigned)(tag >> 2));
+        bytes += strlen(scheme_prefix[tag & 3]) + (host ? strlen(host) : 0) + shared + len + 1;
+    }
+    return bytes;
+}
+
+void frontier_init(frontier_t *f) {
+    memset(f, 0, sizeof(*f));
+}
+
+void frontier_destroy(frontier_t *f) {
+    for (unsigned i = 0; i < f->num_blocks; i++) {
+        free(f->blocks[i]);
+    }
+    free(f->blocks);
+    free(f->spare);
+    frontier_init(f);
+}
+
+size_t frontier_memory(const frontier_t *f) {
+    return (f->num_blocks + (f->spare != NULL)) * sizeof(frontier_block_t) +
+           f->capacity * sizeof(frontier_block_t *);
+}
+
+// Append an empty block as the newest, NULL on allocation failure
+static frontier_block_t *add_block(frontier_t *f) {
+    if (f->num_blocks == f->capacity) {
+        unsigned capacity = f->capacity ? f->capacity * 2 : 16;
+        frontier_block_t **blocks = realloc(f->blocks, capacity * sizeof(*blocks));
+        if (!blocks) return NULL;
+        f->blocks = blocks;
+        f->capacity = capacity;
+    }
+    frontier_block_t *b = f->spare ? f->spare : malloc(sizeof(frontier_block_t));
+    if (!b) return NULL;
+    f->spare = NULL;
+    b->used = b->count = b->num_restarts = 0;
+    f->blocks[f->num_blocks++] = b;
+    return b;
+}
+
+int frontier_push(frontier_t *f, const char *url) {
+    size_t url_len = strlen(url);
+    if (url_len > FRONTIER_URL_MAX) return 0;
+    const char *path;
+    unsigned long tag = url_tag(url, &path);
+    size_t path_len = url_len - (size_t)(path - url);
+
+    frontier_block_t *b = f->num_blocks ? f->blocks[f->num_blocks - 1] : NULL;
+    int restart = !f->tail_valid || f->tail_run >= FRONTIER_RESTART_INTERVAL;
+    size_t shared = 0;
+    if (!restart) {
+        size_t max = path_len < f->tail_len ? path_len : f->tail_len;
+        while (shared < max && path[shared] == f->tail[shared]) shared++;
+    }
+    size_t size = varint_len(tag) + varint_len(shared) + varint_len(path_len - shared) + path_len - shared;
+    if (!b || b->used + size > sizeof(b->data) || (restart && b->num_restarts == FRONTIER_MAX_RESTARTS)) {
+        b = add_block(f);
+        if (!b) return 0;
+        restart = 1;
+        shared = 0;
+        size = varint_len(tag) + varint_len(0) + varint_len(path_len) + path_len;
+    }
+    if (restart) {
+        b->restarts[b->num_restarts++] = b->used;
+        f->tail_run = 0;
+    }
+
+    unsigned char *p = b->data + b->used;
+    p += varint_put(p, tag);
+    p += varint_put(p, shared);
+    p += varint_put(p, path_len - shared);
+    memcpy(p, path + shared, path_len - shared);
+    b->used += size;
+    b->count++;
+
+    memcpy(f->tail + shared, path + shared, path_len - shared);
+    f->tail_len = path_len;
+    f->tail_valid = 1;
+    f->tail_run++;
+    f->count++;
+    f->url_bytes += url_len + 1;
+    return 1;
+}
+
+size_t frontier_pop(frontier_t *f, char *buf, size_t size) {
+    if (f->num_blocks == 0) return 0;
+    frontier_block_t *b = f->blocks[f->num_blocks - 1];
+
+    // Decode the newest run, keeping the path before the last record
+    char cur[FRONTIER_URL_MAX], prev[FRONTIER_URL_MAX];
+    size_t cur_len = 0, prev_len = 0;
+    unsigned long tag = 0;
+    unsigned run = 0;
+    size_t last_off = b->restarts[b->num_restarts - 1];
+    const unsigned char *p = b->data + last_off;
+    const unsigned char *end = b->data + b->used;
+    while (p < end) {
+        memcpy(prev, cur, cur_len);
+        prev_len = cur_len;
+        last_off = (size_t)(p - b->data);
+        tag = varint_get(&p);
+        size_t shared = varint_get(&p);
+        size_t len = varint_get(&p);
+        memcpy(cur + shared, p, len);
+        cur_len = shared + len;
+        p += len;
+        run++;
+    }
+
+    // Rebuild the URL
+    int scheme = (int)(tag & 3);
+    const char *host = scheme == SCHEME_RAW ? "" : host_key((unsigned)(tag >> 2));
+    if (!host) host = "";
+    size_t prefix_len = strlen(scheme_prefix[scheme]);
+    size_t host_len = strlen(host);
+    size_t url_len = prefix_len + host_len + cur_len;
+    if (url_len < size) {
+        memcpy(buf, scheme_prefix[scheme], prefix_len);
+        memcpy(buf + prefix_len, host, host_len);
+        memcpy(buf + prefix_len + host_len, cur, cur_len);
+        buf[url_len] = '\0';
+    } else {
+        url_len = 0;  // cannot happen with a FRONTIER_URL_MAX + 1 buffer
+    }
+
+    // Drop the record
+    b->used = (unsigned short)last_off;
+    b->count--;
+    f->count--;
+    f->url_bytes -= prefix_len + host_len + cur_len + 1;
+    if (run > 1) {
+        memcpy(f->tail, prev, prev_len);
+        f->tail_len = prev_len;
+        f->tail_valid = 1;
+        f->tail_run = run - 1;
+    } else {
+        // The run is gone and the path before it is not at hand
+        b->num_restarts--;
+        f->tail_valid = 0;
+        if (b->count == 0) {
+            free(f->spare);
+            f->spare = b;
+            f->num_blocks--;
+        }
+    }
+    return url_len;
+}
+
+unsigned long frontier_write_oldest(frontier_t *f, FILE *fp, unsigned n) {
+    if (n > f->num_blocks) n = f->num_blocks;
+    unsigned long urls = 0;
+    for (unsigned i = 0; i < n; i++) {
+        frontier_block_t *b = f->blocks[i];
+        if (fwrite(b, 1, BLOCK_HEADER + b->used, fp) != BLOCK_HEADER + b->used) return 0;
+        urls += b->count;
+    }
+    if (fflush(fp) != 0) return 0;
+    // Written out: only now let the blocks go
+    for (unsigned i = 0; i < n; i++) {
+        f->url_bytes -= block_url_bytes(f->blocks[i]);
+        free(f->blocks[i]);
+    }
+    memmove(f->blocks, f->blocks + n, (f->num_blocks - n) * sizeof(*f->blocks));
+    f->num_blocks -= n;
+    f->count -= urls;
+    if (f->num_blocks == 0) f->tail_valid = 0;
+    return urls;
+}
+
+long frontier_read_block(frontier_t *f, FILE *fp) {
+    frontier_block_t header;
+    size_t got = fread(&header, 1, BLOCK_HEADER, fp);
+    if (got == 0 && feof(fp)) return 0;
+    if (got != BLOCK_HEADER || header.used > sizeof(header.data) || header.count == 0 ||
+        header.num_restarts == 0 || header.num_restarts > FRONTIER_MAX_RESTARTS) {
+        return -1;
+    }
+    frontier_block_t *b = add_block(f);
+    if (!b) return -1;
+    memcpy(b, &header, BLOCK_HEADER);
+    if (fread(b->data, 1, b->used, fp) != b->used) {
+        f->spare = b;
+        f->num_blocks--;
+        return -1;
+    }
+    f->url_bytes += block_url_bytes(b);
+    f->count += b->count;
+    f->tail_valid = 0;  // the next push starts a new run
+    return b->count;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file: hosts.c
+ * @brief: host interning and per-host latency statistics, see hosts.h
+ *
+ * Hosts live in fixed size chunks that never move, so a host id can be
+ * turned into its entry without a lock. The key index is an open addressing
+ * table of ids guarded by one mutex, taken only to intern.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "hosts.h"
+#include "fingerprint.h"
+
+#define HOST_KEY_MAX     256
+#define HOST_CHUNK       256    // hosts per chunk
+#define HOST_CHUNKS      4096   // up to one million hosts
+#define LATENCY_BUCKETS  128    // 4 per doubling of microseconds, up to about an hour
+
+typedef struct {
+    char key[HOST_KEY_MAX];
+    atomic_ulong samples;
+    atomic_uint consecutive_failures;
+    atomic_uint buckets[LATENCY_BUCKETS];
+} host_t;
+
+static host_t *chunks[HOST_CHUNKS];
+static atomic_uint num_hosts = 0;
+static unsigned *index_slots = NULL;  // id + 1, 0 marks an empty slot
+static size_t index_capacity = 0;
+static atomic_size_t held_bytes = 0;  // chunks and index
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static host_t *host_at(unsigned id) {
+    if (id >= atomic_load_explicit(&num_hosts, memory_order_acquire)) return NULL;
+    return &chunks[id / HOST_CHUNK][id % HOST_CHUNK];
+}
+
+// Bucket of a latency: the position of the top bit plus the next two bits
+static unsigned latency_bucket(unsigned long long us) {
+    if (us < 4) return (unsigned)us;
+    unsigned msb = 63 - __builtin_clzll(us);
+    unsigned b = msb * 4 + (unsigned)((us >> (msb - 2)) & 3);
+    return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+// Upper edge of a bucket in microseconds
+static unsigned long long bucket_limit(unsigned b) {
+    if (b < 4) return b + 1;
+    unsigned msb = b / 4;
+    return (unsigned long long)(4 + b % 4 + 1) << (msb - 2);
+}
+
+static int index_grow(void) {
+    size_t capacity = index_capacity ? index_capacity * 2 : 1024;
+    unsigned *slots = calloc(capacity, sizeof(unsigned));
+    if (!slots) return 0;
+    unsigned n = atomic_load(&num_hosts);
+    for (unsigned id = 0; id < n; id++) {
+        const char *key = host_at(id)->key;
+        size_t i = fp_hash64(key, strlen(key), 0) & (capacity - 1);
+        while (slots[i]) i = (i + 1) & (capacity - 1);
+        slots[i] = id + 1;
+    }
+    free(index_slots);
+    atomic_fetch_add(&held_bytes, (capacity - index_capacity) * sizeof(unsigned));
+    index_slots = slots;
+    index_capacity = capacity;
+    return 1;
+}
+
+unsigned host_intern_n(const char *host, size_t len) {
+    if (len == 0 || len >= HOST_KEY_MAX) return HOST_NONE;
+    char key[HOST_KEY_MAX];
+    for (size_t i = 0; i < len; i++) key[i] = (char)tolower((unsigned char)host[i]);
+    key[len] = '\0';
+    unsigned long long h = fp_hash64(key, len, 0);
+
+    pthread_mutex_lock(&intern_lock);
+    unsigned n = atomic_load(&num_hosts);
+    if ((n + 1) * 2 > index_capacity && !index_grow()) {
+        pthread_mutex_unlock(&intern_lock);
+        return HOST_NONE;
+    }
+    size_t mask = index_capacity - 1;
+    size_t i = h & mask;
+    while (index_slots[i]) {
+        unsigned id = index_slots[i] - 1;
+        if (strcmp(host_at(id)->key, key) == 0) {
+            pthread_mutex_unlock(&intern_lock);
+            return id;
+        }
+        i = (i + 1) & mask;
+    }
+    if (n / HOST_CHUNK >= HOST_CHUNKS) {
+        pthread_mutex_unlock(&intern_lock);
+        return HOST_NONE;
+    }
+    if (!chunks[n / HOST_CHUNK]) {
+        chunks[n / HOST_CHUNK] = calloc(HOST_CHUNK, sizeof(host_t));
+        if (!chunks[n / HOST_CHUNK]) {
+            pthread_mutex_unlock(&intern_lock);
+            return HOST_NONE;
+        }
+        atomic_fetch_add(&held_bytes, HOST_CHUNK * sizeof(host_t));
+    }
+    host_t *entry = &chunks[n / HOST_CHUNK][n % HOST_CHUNK];
+    memcpy(entry->key, key, len + 1);
+    index_slots[i] = n + 1;
+    atomic_store_explicit(&num_hosts, n + 1, memory_order_release);  // publish the entry
+    pthread_mutex_unlock(&intern_lock);
+    return n;
+}
+
+unsigned host_intern(const char *url) {
+    if (!url) return HOST_NONE;
+    const char *host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    return host_intern_n(host, strcspn(host, "/?#"));
+}
+
+const char *host_key(unsigned id) {
+    host_t *h = host_at(id);
+    return h ? h->key : NULL;
+}
+
+unsigned hosts_count(void) {
+    return atomic_load(&num_hosts);
+}
+
+size_t hosts_memory(void) {
+    return atomic_load(&held_bytes);
+}
+
+void host_record_latency(unsigned id, unsigned long long us) {
+    host_t *h = host_at(id);
+    if (!h) return;
+    atomic_fetch_add_explicit(&h->buckets[latency_bucket(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->samples, 1, memory_order_relaxed);
+    atomic_store_explicit(&h->consecutive_failures, 0, memory_order_relaxed);
+}
+
+unsigned host_record_failure(unsigned id) {
+    host_t *h = host_at(id);
+    if (!h) return 0;
+    return atomic_fetch_add(&h->consecutive_failures, 1) + 1;
+}
+
+unsigned long host_samples(unsigned id) {
+    host_t *h = host_at(id);
+    return h ? atomic_load_explicit(&h->samples, memory_order_relaxed) : 0;
+}
+
+long host_latency_quantile_ms(unsigned id, double q, unsigned long min_samples) {
+    host_t *h = host_at(id);
+    if (!h) return -1;
+    unsigned long total = atomic_load_explicit(&h->samples, memory_order_relaxed);
+    if (total == 0 || total < min_samples) return -1;
+    unsigned long target = (unsigned long)(q * total);
+    if (target >= total) target = total - 1;
+    unsigned long seen = 0;
+    for (unsigned b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        if (seen > target) {
+            return (long)((bucket_limit(b) + 999) / 1000);
+        }
+    }
+    return (long)(bucket_limit(LATENCY_BUCKETS - 1) / 1000);
+}
+
+void hosts_destroy(void) {
+    pthread_mutex_lock(&intern_lock);
+    for (unsigned c = 0; c < HOST_CHUNKS && chunks[c]; c++) {
+        free(chunks[c]);
+        chunks[c] = NULL;
+    }
+    free(index_slots);
+    index_slots = NULL;
+    index_capacity = 0;
+    atomic_store(&held_bytes, 0);
+    atomic_store(&num_hosts, 0);
+    pthread_mutex_unlock(&intern_lock);
+}
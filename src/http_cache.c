@@ -0,0 +1,206 @@
+/**
+ * @file: http_cache.c
+ * @brief: on-disk HTTP revalidation cache, see http_cache.h
+ *
+ * Layout: <dir>/<xx>/<16 hex digits>, where the name is the FNV-1a 64 hash
+ * of the canonical URL and <xx> its first two digits. Each file is a small
+ * text record; the canonical URL is stored too so a hash collision is
+ * detected as a miss. Files are written to a temp name and renamed, so
+ * concurrent writers and readers never see a torn entry.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "http_cache.h"
+
+#define CACHE_MAGIC    "FPC1"
+#define CACHE_URL_MAX  2048
+#define CACHE_PATH_MAX 4096
+
+static char cache_dir[CACHE_PATH_MAX];
+static int cache_ready = 0;
+
+static unsigned long long fnv1a64(const char *s) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int cache_open(const char *dir) {
+    if (!dir || strlen(dir) + 24 >= sizeof(cache_dir)) return 0;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("cache_open: mkdir");
+        return 0;
+    }
+    snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    cache_ready = 1;
+    return 1;
+}
+
+int cache_canonical_url(const char *url, char *out, size_t out_len) {
+    if (!url || !out) return 0;
+
+    const char *scheme_end = strstr(url, "://");
+    if (!scheme_end) return 0;
+    size_t scheme_len = scheme_end - url;
+    const char *host = scheme_end + 3;
+    const char *path = host + strcspn(host, "/?#");
+    const char *port = memchr(host, ':', path - host);
+    size_t host_len = (port ? port : path) - host;
+    size_t port_len = port ? (size_t)(path - port) : 0;
+    size_t path_len = strcspn(path, "#");
+
+    // Drop the port if it is the default one for the scheme
+    if ((port_len == 3 && strncmp(port, ":80", 3) == 0 && scheme_len == 4 && strncasecmp(url, "http", 4) == 0) ||
+        (port_len == 4 && strncmp(port, ":443", 4) == 0 && scheme_len == 5 && strncasecmp(url, "https", 5) == 0)) {
+        port_len = 0;
+    }
+
+    if (scheme_len + 3 + host_len + port_len + path_len + 2 > out_len) return 0;
+
+    char *p = out;
+    for (size_t i = 0; i < scheme_len; i++) *p++ = tolower((unsigned char)url[i]);
+    memcpy(p, "://", 3);
+    p += 3;
+    for (size_t i = 0; i < host_len; i++) *p++ = tolower((unsigned char)host[i]);
+    if (port_len) {
+        memcpy(p, port, port_len);
+        p += port_len;
+    }
+    if (path_len == 0 || path[0] != '/') *p++ = '/';
+    memcpy(p, path, path_len);
+    p += path_len;
+    *p = '\0';
+    return 1;
+}
+
+// Build the on-disk path of the entry for a canonical URL
+static void entry_path(const char *canon, char *out, size_t out_len, int dir_only) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", fnv1a64(canon));
+    if (dir_only) {
+        snprintf(out, out_len, "%s/%.2s", cache_dir, name);
+    } else {
+        snprintf(out, out_len, "%s/%.2s/%s", cache_dir, name, name);
+    }
+}
+
+// Copy a header value, stripping the trailing newline
+static void copy_value(char *dst, const char *src) {
+    size_t len = strcspn(src, "\r\n");
+    if (len >= CACHE_VALUE_MAX) len = CACHE_VALUE_MAX - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+int cache_load(const char *url, cache_entry_t *out) {
+    if (!cache_ready || !out) return 0;
+    memset(out, 0, sizeof(*out));
+
+    char canon[CACHE_URL_MAX];
+    if (!cache_canonical_url(url, canon, sizeof(canon))) return 0;
+
+    char path[CACHE_PATH_MAX];
+    entry_path(canon, path, sizeof(path), 0);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int ok = 0;
+    unsigned expected = 0;
+
+    if (getline(&line, &cap, fp) <= 0 || strncmp(line, CACHE_MAGIC, 4) != 0) goto done;
+    if (getline(&line, &cap, fp) <= 0 || strncmp(line, "url ", 4) != 0) goto done;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line + 4, canon) != 0) goto done;  // hash collision
+
+    while ((n = getline(&line, &cap, fp)) > 0) {
+        if (strncmp(line, "type ", 5) == 0) {
+            out->content_type = atoi(line + 5);
+        } else if (strncmp(line, "etag ", 5) == 0) {
+            copy_value(out->etag, line + 5);
+        } else if (strncmp(line, "lastmod ", 8) == 0) {
+            copy_value(out->last_modified, line + 8);
+        } else if (strncmp(line, "links ", 6) == 0) {
+            expected = (unsigned)strtoul(line + 6, NULL, 10);
+            break;
+        }
+    }
+
+    if (expected > 0) {
+        out->links = calloc(expected, sizeof(char *));
+        if (!out->links) goto done;
+        while (out->num_links < expected && (n = getline(&line, &cap, fp)) > 0) {
+            line[strcspn(line, "\r\n")] = '\0';
+            out->links[out->num_links] = strdup(line);
+            if (!out->links[out->num_links]) goto done;
+            out->num_links++;
+        }
+        if (out->num_links != expected) goto done;  // truncated entry
+    }
+    ok = out->etag[0] != '\0' || out->last_modified[0] != '\0';
+
+done:
+    free(line);
+    fclose(fp);
+    if (!ok) cache_entry_free(out);
+    return ok;
+}
+
+int cache_store(const char *url, const cache_entry_t *in) {
+    if (!cache_ready || !in) return 0;
+
+    char canon[CACHE_URL_MAX];
+    if (!cache_canonical_url(url, canon, sizeof(canon))) return 0;
+
+    char dir[CACHE_PATH_MAX], path[CACHE_PATH_MAX], tmp[CACHE_PATH_MAX + 8];
+    entry_path(canon, dir, sizeof(dir), 1);
+    entry_path(canon, path, sizeof(path), 0);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) return 0;
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        unlink(tmp);
+        return 0;
+    }
+
+    fprintf(fp, "%s\nurl %s\ntype %d\n", CACHE_MAGIC, canon, in->content_type);
+    fprintf(fp, "etag %s\nlastmod %s\n", in->etag, in->last_modified);
+    fprintf(fp, "links %u\n", in->num_links);
+    for (unsigned i = 0; i < in->num_links; i++) {
+        fprintf(fp, "%s\n", in->links[i]);
+    }
+
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+void cache_entry_free(cache_entry_t *e) {
+    if (!e) return;
+    for (unsigned i = 0; i < e->num_links; i++) {
+        free(e->links[i]);
+    }
+    free(e->links);
+    e->links = NULL;
+    e->num_links = 0;
+}
@@ -1,7 +1,16 @@
+#define _DEFAULT_SOURCE  // madvise
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 #include <arpa/inet.h> // for ntohl, htonl
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "zutil.h"
 #include "lab_png.h"
 #include "crc.h"
@@ -117,6 +126,149 @@ U32 calculate_chunk_crc(chunk_p in) {
     return crc_val;
 }
 
+// Map a file for reading; an empty file gives an empty view
+int png_view_open(png_view_t *v, const char *path) {
+    memset(v, 0, sizeof(*v));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return 0;
+        }
+        v->data = map;
+        v->len = (size_t)st.st_size;
+        v->mapped = 1;
+    }
+    close(fd);  // the mapping stays valid
+    return 1;
+}
+
+void png_view_mem(png_view_t *v, const U8 *buf, size_t len) {
+    v->data = buf;
+    v->len = buf ? len : 0;
+    v->mapped = 0;
+}
+
+void png_view_close(png_view_t *v) {
+    if (v->mapped) munmap((void *)v->data, v->len);
+    memset(v, 0, sizeof(*v));
+}
+
+static U32 be32(const U8 *p) {
+    return (U32)p[0] << 24 | (U32)p[1] << 16 | (U32)p[2] << 8 | p[3];
+}
+
+int png_chunk_iter_init(png_chunk_iter_t *it, const png_view_t *v) {
+    it->pos = it->end = NULL;
+    it->truncated = 0;
+    if (!v->data || !is_png((U8 *)v->data, v->len)) return 0;
+    it->pos = v->data + PNG_SIG_SIZE;
+    it->end = v->data + v->len;
+    return 1;
+}
+
+int png_chunk_next(png_chunk_iter_t *it, png_chunk_ref_t *out) {
+    if (!it->pos || it->pos == it->end) return 0;
+    size_t left = (size_t)(it->end - it->pos);
+    size_t overhead = CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + CHUNK_CRC_SIZE;
+    U32 length = left >= CHUNK_LEN_SIZE ? be32(it->pos) : 0;
+    if (left < overhead || length > 0x7fffffffU || length > left - overhead) {
+        it->truncated = 1;
+        it->pos = it->end;
+        return 0;
+    }
+    out->length = length;
+    out->type = it->pos + CHUNK_LEN_SIZE;
+    out->data = out->type + CHUNK_TYPE_SIZE;
+    out->crc = be32(out->data + length);
+    it->pos = out->data + length + CHUNK_CRC_SIZE;
+    return 1;
+}
+
+int png_chunk_is(const png_chunk_ref_t *c, const char *type) {
+    return memcmp(c->type, type, CHUNK_TYPE_SIZE) == 0;
+}
+
+U32 png_chunk_calc_crc(const png_chunk_ref_t *c) {
+    unsigned long r = update_crc(0xffffffffL, (U8 *)c->type, CHUNK_TYPE_SIZE);
+    r = update_crc(r, (U8 *)c->data, (int)c->length);
+    return (U32)(r ^ 0xffffffffL);
+}
+
+int png_view_IHDR(struct data_IHDR *out, const png_view_t *v) {
+    png_chunk_iter_t it;
+    png_chunk_ref_t c;
+    if (!png_chunk_iter_init(&it, v) || !png_chunk_next(&it, &c) ||
+        !png_chunk_is(&c, "IHDR") || c.length != DATA_IHDR_SIZE) {
+        return 0;
+    }
+    out->width       = be32(c.data);
+    out->height      = be32(c.data + 4);
+    out->bit_depth   = c.data[8];
+    out->color_type  = c.data[9];
+    out->compression = c.data[10];
+    out->filter      = c.data[11];
+    out->interlace   = c.data[12];
+    return 1;
+}
+
+// Feed every IDAT to one inflate stream, straight from the view
+int png_view_inflate(const png_view_t *v, U8 *dest, size_t *dest_len) {
+    mem_ctx_t ctx;
+    int ret = mem_inf_init(&ctx, 0);
+    if (ret != Z_OK) return ret;
+    ret = png_view_inflate_ctx(&ctx, v, dest, dest_len);
+    mem_ctx_end(&ctx);
+    return ret;
+}
+
+// png_view_inflate on a stream that is only reset, for callers that
+// inflate many views in turn
+int png_view_inflate_ctx(struct mem_ctx *ctx, const png_view_t *v, U8 *dest, size_t *dest_len) {
+    png_chunk_iter_t it;
+    png_chunk_ref_t c;
+    if (!png_chunk_iter_init(&it, v)) return Z_DATA_ERROR;
+
+    z_stream *strm = &ctx->strm;
+    int ret = inflateReset(strm);
+    if (ret != Z_OK) return ret;
+    // avail_out is 32 bits, so dest is handed over a piece at a time
+    size_t room = *dest_len;
+    strm->next_out = dest;
+    strm->avail_out = room > UINT_MAX ? UINT_MAX : (uInt)room;
+    room -= strm->avail_out;
+
+    ret = Z_DATA_ERROR;  // until the stream ends
+    while (ret != Z_STREAM_END && png_chunk_next(&it, &c)) {
+        if (!png_chunk_is(&c, "IDAT")) continue;
+        strm->next_in = (U8 *)c.data;
+        strm->avail_in = c.length;
+        while (strm->avail_in > 0) {
+            if (strm->avail_out == 0 && room > 0) {
+                strm->avail_out = room > UINT_MAX ? UINT_MAX : (uInt)room;
+                room -= strm->avail_out;
+            }
+            ret = inflate(strm, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) break;
+            if (ret != Z_OK) {
+                // Z_BUF_ERROR here means dest is full
+                return ret == Z_NEED_DICT ? Z_DATA_ERROR : ret;
+            }
+            ret = Z_DATA_ERROR;
+        }
+    }
+    *dest_len -= room + strm->avail_out;
+    if (ret == Z_STREAM_END) return Z_OK;
+    return strm->avail_out == 0 && room == 0 ? Z_BUF_ERROR : Z_DATA_ERROR;
+}
+
 // Write a chunk to a file
 int write_chunk(FILE* fp, chunk_p in) {
     if (!fp || !in) return 0;
@@ -156,140 +308,1003 @@ int write_PNG(char* filepath, simple_PNG_p in) {
     return success ? 1 : 0;
 }
 
-// save a complete PNG assembled from 50 PNG strip buffers
-int save_png_from_memstrips(const unsigned char *data[], const size_t sizes[], const char *filename) { // Reusing from some part of catpng.c
-	FILE *out = fopen(filename, "wb");
-	if (!out) {
-		fprintf(stderr, "Error: Cannot create all.png\n");
-		return EXIT_FAILURE;
-	}
+// Bytes of filtered scanlines in a non-interlaced image: one filter byte
+// plus the packed samples per row
+size_t png_raw_size(const struct data_IHDR *hdr) {
+    unsigned channels;
+    switch (hdr->color_type) {
+        case 0: case 3: channels = 1; break;
+        case 2: channels = 3; break;
+        case 4: channels = 2; break;
+        case 6: channels = 4; break;
+        default: return 0;
+    }
+    unsigned depth = hdr->bit_depth;
+    if (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) return 0;
+    if (hdr->interlace != 0 || hdr->width == 0 || hdr->height == 0 ||
+        hdr->width > PNG_DIM_MAX || hdr->height > PNG_DIM_MAX) {
+        return 0;
+    }
+    // under 2^38 for any valid width, then checked against what size_t holds
+    U64 row_bytes = ((U64)hdr->width * channels * depth + 7) / 8 + 1;
+    if (row_bytes > SIZE_MAX / hdr->height) return 0;
+    return (size_t)(row_bytes * hdr->height);
+}
 
-    // write standard 8-byte PNG signature to file
-	U8 sig[PNG_SIG_SIZE] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
-	fwrite(sig, 1, PNG_SIG_SIZE, out);
+// First pass over a strip: 1 if it can be stacked under ref (NULL for the
+// first strip), with its IHDR in hdr and its palette, if any, in plte.
+// Palette images must share ref_plte. Warnings name the strip when name is set.
+static int stitch_check(const png_view_t *v, const char *name, const struct data_IHDR *ref,
+                        const png_chunk_ref_t *ref_plte, struct data_IHDR *hdr, png_chunk_ref_t *plte) {
+    png_chunk_iter_t it;
+    if (!png_chunk_iter_init(&it, v)) {
+        if (name) fprintf(stderr, "Warning: %s is not a valid PNG\n", name);
+        return 0;
+    }
+    if (!png_view_IHDR(hdr, v) || png_raw_size(hdr) == 0) {
+        if (name) fprintf(stderr, "Warning: Invalid IHDR in %s\n", name);
+        return 0;
+    }
+    if (ref && (hdr->width != ref->width || hdr->bit_depth != ref->bit_depth ||
+                hdr->color_type != ref->color_type || hdr->compression != ref->compression ||
+                hdr->filter != ref->filter || hdr->interlace != ref->interlace)) {
+        if (name) fprintf(stderr, "Warning: %s has incompatible IHDR\n", name);
+        return 0;
+    }
 
-	struct data_IHDR ref_hdr; // store IHDR info from the first valid stip
-	U8 *concat_data = NULL; // pointer to full uncompressed image buffer
-	U64 concat_size = 0; // total size of all uncompressed strips
-	U32 total_height = 0; // cumulative height of all strips
+    // check every IDAT in place, however many there are
+    png_chunk_ref_t c;
+    int idats = 0, crc_ok = 1;
+    plte->length = 0;
+    plte->data = NULL;
+    while (crc_ok && png_chunk_next(&it, &c)) {
+        if (png_chunk_is(&c, "IDAT")) {
+            idats++;
+            crc_ok = c.crc == png_chunk_calc_crc(&c);
+        } else if (png_chunk_is(&c, "PLTE")) {
+            *plte = c;
+        }
+    }
+    if (!crc_ok) {
+        if (name) fprintf(stderr, "Warning: IDAT CRC mismatch in %s\n", name);
+        return 0;
+    }
+    if (idats == 0 || it.truncated) {
+        if (name) fprintf(stderr, "Warning: Missing or invalid IDAT in %s\n", name);
+        return 0;
+    }
+    if (hdr->color_type == 3 && (!plte->data || (ref_plte && (plte->length != ref_plte->length ||
+                                 memcmp(plte->data, ref_plte->data, plte->length) != 0)))) {
+        if (name) fprintf(stderr, "Warning: %s has a missing or different palette\n", name);
+        return 0;
+    }
+    return 1;
+}
 
-	for (int i = 0; i < 50; ++i) {
-        // open memory buffer as file stream for strip i
-        FILE *fp = fmemopen((void *)data[i], sizes[i], "rb");
-		if (!fp) {
-			continue;
-		}
-
-        // check if strip is a valid PNG and read IHDR info
-        U8 sig_buf[PNG_SIG_SIZE];
-		if (fread(sig_buf, 1, PNG_SIG_SIZE, fp) != PNG_SIG_SIZE || !is_png(sig_buf, PNG_SIG_SIZE) || !get_png_data_IHDR(&ref_hdr, fp, PNG_SIG_SIZE, SEEK_SET)) {
-			//fprintf(stderr, "Warning: %s is not a valid PNG\n");
-			fclose(fp);
-			continue;
-		}
-
-
-        // parse PNG chunks (IHDR, IDAT, IEND)
-		simple_PNG_p png = mallocPNG();
-		if (!get_png_chunks(png, fp, PNG_SIG_SIZE, SEEK_SET)) {
-            free_png(png);
-			fclose(fp);
-			continue;
-		}
-
-        // estimate raw image size
-        U32 bpp = 4; // RGBA
-        U64 est_raw_size = ref_hdr.height * (ref_hdr.width * bpp + 1);
-        U8 *raw = malloc(est_raw_size);
-        U64 raw_len = 0;
-
-        // decompress IDAT data into raw scanlines
-        if (!raw || mem_inf(raw, &raw_len, png->p_IDAT->p_data, png->p_IDAT->length) != Z_OK) {
-            free(raw);
-            free_png(png);
-            fclose(fp);
+static void write_ihdr(FILE *out, const struct data_IHDR *ref, U32 height) {
+    U8 ihdr_data[DATA_IHDR_SIZE];
+    struct chunk ihdr = {.length = DATA_IHDR_SIZE, .p_data = ihdr_data};
+    memcpy(ihdr.type, "IHDR", 4);
+    U32 net_width = htonl(ref->width);
+    U32 net_height = htonl(height);
+    memcpy(ihdr_data, &net_width, 4);
+    memcpy(ihdr_data + 4, &net_height, 4);
+    ihdr_data[8] = ref->bit_depth;
+    ihdr_data[9] = ref->color_type;
+    ihdr_data[10] = ref->compression;
+    ihdr_data[11] = ref->filter;
+    ihdr_data[12] = ref->interlace;
+    ihdr.crc = calculate_chunk_crc(&ihdr);
+    write_chunk(out, &ihdr);
+}
+
+// Write signature, IHDR and, for palette images, the palette of the
+// stitched image
+static void write_head(FILE *out, const struct data_IHDR *ref, const png_chunk_ref_t *plte, U32 height) {
+    U8 sig[PNG_SIG_SIZE] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    fwrite(sig, 1, PNG_SIG_SIZE, out);
+    write_ihdr(out, ref, height);
+
+    if (ref->color_type == 3) {
+        struct chunk palette = {.length = plte->length, .p_data = (U8 *)plte->data, .crc = plte->crc};
+        memcpy(palette.type, "PLTE", 4);
+        write_chunk(out, &palette);
+    }
+}
+
+static void write_iend(FILE *out) {
+    struct chunk iend = {.length = 0, .p_data = NULL};
+    memcpy(iend.type, "IEND", 4);
+    iend.crc = calculate_chunk_crc(&iend);
+    write_chunk(out, &iend);
+}
+
+// Write the filled part of the buffer as one IDAT
+static int writer_emit(png_writer_t *w) {
+    size_t len = PNG_IDAT_CHUNK - w->zs.avail_out;
+    if (len == 0) return w->ok;
+    U8 head[8];
+    U32 net_len = htonl((U32)len);
+    memcpy(head, &net_len, 4);
+    memcpy(head + 4, "IDAT", 4);
+    unsigned long crc = update_crc(0xffffffffUL, head + 4, 4);
+    crc = update_crc(crc, w->buf, (int)len);
+    U32 net_crc = htonl((U32)(crc ^ 0xffffffffUL));
+    if (fwrite(head, 1, 8, w->out) != 8 || fwrite(w->buf, 1, len, w->out) != len ||
+        fwrite(&net_crc, 1, 4, w->out) != 4) {
+        w->ok = 0;
+    }
+    w->zs.next_out = w->buf;
+    w->zs.avail_out = PNG_IDAT_CHUNK;
+    return w->ok;
+}
+
+// Deflate the pending input, emitting every IDAT that fills up
+static int writer_deflate(png_writer_t *w, int flush) {
+    int ret;
+    do {
+        ret = deflate(&w->zs, flush);
+        if (ret == Z_STREAM_ERROR) return w->ok = 0;
+        if (w->zs.avail_out == 0 && !writer_emit(w)) return 0;
+    } while (w->zs.avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return w->ok;
+}
+
+// Copy compressed bytes into the IDAT buffer, emitting it when full
+static int writer_put(png_writer_t *w, const U8 *p, size_t n) {
+    while (w->ok && n > 0) {
+        size_t take = n < w->zs.avail_out ? n : w->zs.avail_out;
+        memcpy(w->zs.next_out, p, take);
+        w->zs.next_out += take;
+        w->zs.avail_out -= take;
+        p += take;
+        n -= take;
+        if (w->zs.avail_out == 0) writer_emit(w);
+    }
+    return w->ok;
+}
+
+#define DEF_DICT (32 * 1024)
+enum { BLOCK_FREE, BLOCK_QUEUED, BLOCK_DONE };
+
+// PAR_DEF_BLOCK bytes of rows, after the input before them as dictionary
+typedef struct {
+    U8 *in;
+    size_t dict;
+    size_t len;
+    U8 *out;
+    U64 out_len;
+    uLong check;
+    int last;
+    int state;
+    int ret;
+} def_block_t;
+
+// Blocks form a ring in sequence: append fills block queued_seq, workers
+// take job_seq and the writer emits emit_seq, in the manner of pigz
+struct png_def_pool {
+    def_block_t *blocks;
+    int nblocks;
+    U64 queued_seq;
+    U64 job_seq;
+    U64 emit_seq;
+    int level;
+    int stop;
+    uLong adler;
+    U8 tail[DEF_DICT];      // the end of the last block queued
+    size_t tail_len;
+    pthread_t *tids;
+    int started;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static void *def_worker(void *arg) {
+    struct png_def_pool *p = arg;
+    mem_ctx_t ctx;  // reset for each block rather than set up again
+    int init = mem_def_init(&ctx, p->level, 1);
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->job_seq == p->queued_seq && !p->stop) {
+            pthread_cond_wait(&p->changed, &p->lock);
+        }
+        if (p->job_seq == p->queued_seq) break;
+        def_block_t *b = &p->blocks[p->job_seq++ % p->nblocks];
+        pthread_mutex_unlock(&p->lock);
+        b->out_len = mem_def_bound(PAR_DEF_BLOCK);
+        b->ret = init != Z_OK ? init
+               : mem_def_block(&ctx, b->out, &b->out_len, b->in, b->dict, b->in + b->dict, b->len, b->last);
+        b->check = adler32(adler32(0L, Z_NULL, 0), b->in + b->dict, b->len);
+        pthread_mutex_lock(&p->lock);
+        b->state = BLOCK_DONE;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (init == Z_OK) mem_ctx_end(&ctx);
+    return NULL;
+}
+
+// Write out the finished blocks at the head of the ring, in order. With
+// wait, block until no more than keep blocks are still in flight
+static void pool_emit(png_writer_t *w, int wait, U64 keep) {
+    struct png_def_pool *p = w->pool;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        def_block_t *b = &p->blocks[p->emit_seq % p->nblocks];
+        if (p->emit_seq < p->queued_seq && b->state == BLOCK_DONE) {
+            pthread_mutex_unlock(&p->lock);
+            if (b->ret != Z_OK) w->ok = 0;
+            writer_put(w, b->out, b->out_len);
+            p->adler = adler32_combine(p->adler, b->check, (z_off_t)b->len);
+            pthread_mutex_lock(&p->lock);
+            b->state = BLOCK_FREE;
+            p->emit_seq++;
+        } else if (wait && p->queued_seq - p->emit_seq > keep) {
+            pthread_cond_wait(&p->changed, &p->lock);
+        } else {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Hand the block being filled to the workers; unless it was the last, make
+// the next one ready, primed with the end of this one
+static void pool_submit(png_writer_t *w, int last) {
+    struct png_def_pool *p = w->pool;
+    def_block_t *b = &p->blocks[p->queued_seq % p->nblocks];
+    size_t have = b->dict + b->len;
+    p->tail_len = have < DEF_DICT ? have : DEF_DICT;
+    memcpy(p->tail, b->in + have - p->tail_len, p->tail_len);
+    b->last = last;
+    pthread_mutex_lock(&p->lock);
+    b->state = BLOCK_QUEUED;
+    p->queued_seq++;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    if (last) return;
+
+    pool_emit(w, 1, p->nblocks - 1);  // the next slot must be free
+    def_block_t *next = &p->blocks[p->queued_seq % p->nblocks];
+    memcpy(next->in, p->tail, p->tail_len);
+    next->dict = p->tail_len;
+    next->len = 0;
+}
+
+static void pool_free(struct png_def_pool *p) {
+    if (p->blocks) {
+        for (int i = 0; i < p->nblocks; i++) {
+            free(p->blocks[i].in);
+            free(p->blocks[i].out);
+        }
+    }
+    free(p->blocks);
+    free(p->tids);
+    free(p);
+}
+
+static struct png_def_pool *pool_start(int level, int threads) {
+    struct png_def_pool *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->level = level;
+    p->nblocks = 2 * threads;
+    p->adler = adler32(0L, Z_NULL, 0);
+    p->blocks = calloc(p->nblocks, sizeof(*p->blocks));
+    p->tids = malloc(threads * sizeof(*p->tids));
+    if (!p->blocks || !p->tids) {
+        pool_free(p);
+        return NULL;
+    }
+    for (int i = 0; i < p->nblocks; i++) {
+        p->blocks[i].in = malloc(DEF_DICT + PAR_DEF_BLOCK);
+        p->blocks[i].out = malloc(mem_def_bound(PAR_DEF_BLOCK));
+        if (!p->blocks[i].in || !p->blocks[i].out) {
+            pool_free(p);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    while (p->started < threads && pthread_create(&p->tids[p->started], NULL, def_worker, p) == 0) {
+        p->started++;
+    }
+    if (p->started == 0) {
+        pthread_cond_destroy(&p->changed);
+        pthread_mutex_destroy(&p->lock);
+        pool_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static void pool_stop(struct png_def_pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    for (int k = 0; k < p->started; k++) {
+        pthread_join(p->tids[k], NULL);
+    }
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    pool_free(p);
+}
+
+// Set up the IDAT buffer of a zeroed or deflate-ready writer and write
+// everything before the first IDAT; data already compressed can go
+// straight in with writer_put
+static int writer_open(png_writer_t *w, FILE *out, const struct data_IHDR *hdr, const png_chunk_ref_t *plte) {
+    w->out = out;
+    w->buf = malloc(PNG_IDAT_CHUNK);
+    if (!w->buf) return 0;
+    w->zs.next_out = w->buf;
+    w->zs.avail_out = PNG_IDAT_CHUNK;
+    w->ok = 1;
+    w->hdr = *hdr;
+    long pos = ftell(out);
+    w->ihdr_pos = pos < 0 ? -1 : pos + PNG_SIG_SIZE;
+    write_head(out, hdr, plte, hdr->height);
+    return 1;
+}
+
+// Emit the last IDAT and IEND and free the buffer
+static int writer_close(png_writer_t *w) {
+    if (w->ok) writer_emit(w);
+    if (w->ok) write_iend(w->out);
+    free(w->buf);
+    w->buf = NULL;
+    return w->ok && !ferror(w->out);
+}
+
+// Nothing is left to clean up when this fails. Without a pool of threads
+// the rows are deflated inline
+int png_writer_begin(png_writer_t *w, FILE *out, const struct data_IHDR *hdr, const png_chunk_ref_t *plte,
+                     int level, int threads) {
+    memset(w, 0, sizeof(*w));
+    if (threads > 1) w->pool = pool_start(level, threads);
+    if (!w->pool && deflateInit(&w->zs, level) != Z_OK) return 0;
+    if (!writer_open(w, out, hdr, plte)) {
+        if (w->pool) pool_stop(w->pool);
+        else deflateEnd(&w->zs);
+        return 0;
+    }
+    if (w->pool) {
+        U8 zhdr[2];
+        mem_def_header(zhdr, level);
+        writer_put(w, zhdr, 2);
+    }
+    return 1;
+}
+
+int png_writer_set_height(png_writer_t *w, U32 height) {
+    if (height == w->hdr.height) return w->ok;
+    if (w->ihdr_pos < 0 || fseek(w->out, w->ihdr_pos, SEEK_SET) != 0) return w->ok = 0;
+    w->hdr.height = height;
+    write_ihdr(w->out, &w->hdr, height);
+    if (fseek(w->out, 0, SEEK_END) != 0) w->ok = 0;
+    return w->ok;
+}
+
+int png_writer_append(png_writer_t *w, const U8 *rows, size_t len) {
+    if (w->pool) {
+        while (w->ok && len > 0) {
+            def_block_t *b = &w->pool->blocks[w->pool->queued_seq % w->pool->nblocks];
+            size_t take = PAR_DEF_BLOCK - b->len < len ? PAR_DEF_BLOCK - b->len : len;
+            memcpy(b->in + b->dict + b->len, rows, take);
+            b->len += take;
+            rows += take;
+            len -= take;
+            if (b->len == PAR_DEF_BLOCK) pool_submit(w, 0);
+        }
+        pool_emit(w, 0, 0);
+        return w->ok;
+    }
+    while (w->ok && len > 0) {
+        uInt n = len > UINT_MAX ? UINT_MAX : (uInt)len;
+        w->zs.next_in = (Bytef *)rows;
+        w->zs.avail_in = n;
+        writer_deflate(w, Z_NO_FLUSH);
+        rows += n;
+        len -= n;
+    }
+    return w->ok;
+}
+
+int png_writer_finish(png_writer_t *w) {
+    if (w->pool) {
+        pool_submit(w, 1);
+        pool_emit(w, 1, 0);
+        U8 trailer[4];
+        U32 net_adler = htonl((U32)w->pool->adler);
+        memcpy(trailer, &net_adler, 4);
+        writer_put(w, trailer, 4);
+        pool_stop(w->pool);
+        w->pool = NULL;
+    } else {
+        w->zs.next_in = NULL;
+        w->zs.avail_in = 0;
+        if (w->ok) writer_deflate(w, Z_FINISH);
+        deflateEnd(&w->zs);
+    }
+    return writer_close(w);
+}
+
+// Write the stitched image from memory, deflating it on threads
+static int write_stitched(FILE *out, const struct data_IHDR *ref, const png_chunk_ref_t *plte,
+                          U32 height, U8 *raw, size_t raw_len, int threads) {
+    struct data_IHDR hdr = *ref;
+    hdr.height = height;
+    png_writer_t w;
+    if (!png_writer_begin(&w, out, &hdr, plte, Z_DEFAULT_COMPRESSION, threads)) {
+        fprintf(stderr, "Error: Compression failed\n");
+        return 0;
+    }
+    png_writer_append(&w, raw, raw_len);
+    if (!png_writer_finish(&w)) {
+        fprintf(stderr, "Error: Writing the image failed\n");
+        return 0;
+    }
+    return 1;
+}
+
+// A usable strip and the slot of the image it inflates into. A fast join
+// fills in the bit offsets, counted from the start of the strip's zlib
+// stream, instead
+typedef struct {
+    const png_view_t *view;
+    const char *name;
+    size_t offset;
+    size_t size;
+    U32 height;
+    int ok;
+    U64 final_bit;          // header of the last deflate block
+    U64 end_bit;            // just past that block's end code
+    uLong adler;
+} stitch_strip_t;
+
+// Strips shared by the workers, taken in order by index
+typedef struct stitch_pool {
+    stitch_strip_t *strips;
+    int count;
+    int next;
+    U8 *raw;
+    void (*work)(struct stitch_pool *pool, stitch_strip_t *st, mem_ctx_t *ctx);
+    pthread_mutex_t lock;
+} stitch_pool_t;
+
+// Work functions get the worker's inflate stream, or NULL if it could not
+// be set up
+static void inflate_strip(stitch_pool_t *pool, stitch_strip_t *st, mem_ctx_t *ctx) {
+    size_t got = st->size;
+    U8 *dest = pool->raw + st->offset;
+    int ret = ctx ? png_view_inflate_ctx(ctx, st->view, dest, &got) : png_view_inflate(st->view, dest, &got);
+    st->ok = ret == Z_OK && got == st->size;
+}
+
+// Run the strip through inflate one deflate block at a time, appending
+// the output to w or, without one, dropping it. Z_BLOCK returns at every
+// block boundary with the unused bits of the last byte read in data_type,
+// plus 64 once the last block has begun, which is where a fast join
+// splices; the stream's own adler32 is checked at the end. ctx is an
+// inflate stream to reset, or NULL to set one up for this strip
+static int walk_strip(stitch_strip_t *st, png_writer_t *w, mem_ctx_t *ctx) {
+    U8 window[32768];
+    mem_ctx_t own;
+    png_chunk_iter_t it;
+    png_chunk_ref_t c;
+    if (!png_chunk_iter_init(&it, st->view)) return 0;
+    if (ctx ? inflateReset(&ctx->strm) != Z_OK : mem_inf_init(&own, 0) != Z_OK) return 0;
+    z_stream *strm = ctx ? &ctx->strm : &own.strm;
+    int ret = Z_OK;
+    int found_end = 0;
+    U64 in_before = 0, out_total = 0;  // total_in/out may be 32 bits
+    while (ret == Z_OK && png_chunk_next(&it, &c)) {
+        if (!png_chunk_is(&c, "IDAT")) continue;
+        strm->next_in = (Bytef *)c.data;
+        strm->avail_in = c.length;
+        do {
+            strm->next_out = window;
+            strm->avail_out = sizeof(window);
+            ret = inflate(strm, Z_BLOCK);
+            if (ret == Z_BUF_ERROR) {  // wants the next IDAT
+                ret = Z_OK;
+                break;
+            }
+            if (ret != Z_OK && ret != Z_STREAM_END) break;
+            out_total += sizeof(window) - strm->avail_out;
+            if (w && !png_writer_append(w, window, sizeof(window) - strm->avail_out)) {
+                ret = Z_ERRNO;
+                break;
+            }
+            if (ret == Z_OK && (strm->data_type & 128) && !found_end) {
+                U64 bit = (in_before + c.length - strm->avail_in) * 8 - (strm->data_type & 7);
+                if (strm->data_type & 64) {
+                    st->end_bit = bit;
+                    found_end = 1;
+                } else {
+                    st->final_bit = bit;
+                }
+            }
+        } while (ret == Z_OK && (strm->avail_in > 0 || strm->avail_out == 0));
+        in_before += c.length;
+    }
+    int ok = ret == Z_STREAM_END && found_end && out_total == st->size;
+    st->adler = strm->adler;
+    if (!ctx) mem_ctx_end(&own);
+    return ok;
+}
+
+static void scan_strip(stitch_pool_t *pool, stitch_strip_t *st, mem_ctx_t *ctx) {
+    (void)pool;
+    st->ok = walk_strip(st, NULL, ctx);
+}
+
+static void *strip_worker(void *arg) {
+    stitch_pool_t *pool = arg;
+    mem_ctx_t ctx;  // one inflate stream per thread, reset for each strip
+    int init = mem_inf_init(&ctx, 0);
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        int i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->count) break;
+        pool->work(pool, &pool->strips[i], init == Z_OK ? &ctx : NULL);
+    }
+    if (init == Z_OK) mem_ctx_end(&ctx);
+    return NULL;
+}
+
+// Do work on every strip, on up to threads threads
+static void run_strips(stitch_strip_t *strips, int count, U8 *raw, int threads,
+                       void (*work)(stitch_pool_t *, stitch_strip_t *, mem_ctx_t *)) {
+    stitch_pool_t pool = { .strips = strips, .count = count, .next = 0, .raw = raw, .work = work };
+    pthread_mutex_init(&pool.lock, NULL);
+    if (threads > count) threads = count;
+    pthread_t *tids = threads > 1 ? malloc((threads - 1) * sizeof(*tids)) : NULL;
+    int started = 0;
+    while (tids && started < threads - 1 && pthread_create(&tids[started], NULL, strip_worker, &pool) == 0) {
+        started++;
+    }
+    strip_worker(&pool);  // the caller works too
+    for (int k = 0; k < started; k++) {
+        pthread_join(tids[k], NULL);
+    }
+    free(tids);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+// Put bytes [from, to) of a strip's zlib stream, which may span several
+// IDATs, straight from the view
+static void put_stream(png_writer_t *w, const png_view_t *v, U64 from, U64 to) {
+    png_chunk_iter_t it;
+    png_chunk_ref_t c;
+    U64 pos = 0;
+    png_chunk_iter_init(&it, v);
+    while (from < to && png_chunk_next(&it, &c)) {
+        if (!png_chunk_is(&c, "IDAT")) continue;
+        if (from < pos + c.length) {
+            U64 end = to < pos + c.length ? to : pos + c.length;
+            writer_put(w, c.data + (from - pos), end - from);
+            from = end;
+        }
+        pos += c.length;
+    }
+}
+
+static U8 stream_byte(const png_view_t *v, U64 at) {
+    png_chunk_iter_t it;
+    png_chunk_ref_t c;
+    U64 pos = 0;
+    png_chunk_iter_init(&it, v);
+    while (png_chunk_next(&it, &c)) {
+        if (!png_chunk_is(&c, "IDAT")) continue;
+        if (at < pos + c.length) return c.data[at - pos];
+        pos += c.length;
+    }
+    return 0;
+}
+
+// Copy one strip's deflate data. All but the last strip get BFINAL of their
+// last block cleared and an empty stored block appended to get back to a
+// byte boundary. The stored block's 3 header bits fit after the end code
+// unless that left fewer than 3 bits free, or none at all
+static void put_strip(png_writer_t *w, const stitch_strip_t *st, int last) {
+    static const U8 stored[5] = {0x00, 0x00, 0x00, 0xff, 0xff};
+    U64 final_byte = st->final_bit / 8;
+    U64 end = (st->end_bit + 7) / 8;
+    unsigned used = st->end_bit % 8;
+    put_stream(w, st->view, 2, final_byte);
+    for (U64 i = final_byte; i < end; i++) {
+        if (i > final_byte && i < end - 1) {
+            put_stream(w, st->view, i, end - 1);
+            i = end - 1;
+        }
+        U8 b = stream_byte(st->view, i);
+        if (!last && i == final_byte) b &= ~(1 << (st->final_bit % 8));
+        if (i == end - 1 && used) b &= (1 << used) - 1;
+        writer_put(w, &b, 1);
+    }
+    if (!last) {
+        int extra = used == 0 || used > 5;
+        writer_put(w, stored + 1 - extra, 4 + extra);
+    }
+}
+
+// Write the stitched image with the strips' own deflate streams spliced
+// together, the way zlib's gzjoin example joins gzip members. Nothing is
+// recompressed: the scan found every splice point and the trailer is the
+// strips' checksums combined
+static int write_joined(FILE *out, const struct data_IHDR *ref, const png_chunk_ref_t *plte,
+                        U32 height, const stitch_strip_t *strips, int count) {
+    struct data_IHDR hdr = *ref;
+    hdr.height = height;
+    png_writer_t w = {0};
+    if (!writer_open(&w, out, &hdr, plte)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return 0;
+    }
+
+    // A fresh header declaring the full 32K window: copying the first
+    // strip's would keep its window size, and a later strip's distances can
+    // reach further back. The level bits in it are only a hint
+    U8 zhdr[2];
+    mem_def_header(zhdr, Z_DEFAULT_COMPRESSION);
+    writer_put(&w, zhdr, 2);
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int i = 0; i < count; i++) {
+        put_strip(&w, &strips[i], i == count - 1);
+        adler = adler32_combine(adler, strips[i].adler, (z_off_t)strips[i].size);
+    }
+    U8 trailer[4];
+    U32 net_adler = htonl((U32)adler);
+    memcpy(trailer, &net_adler, 4);
+    writer_put(&w, trailer, 4);
+
+    if (!writer_close(&w)) {
+        fprintf(stderr, "Error: Writing the image failed\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Write the stitched image through a png_writer, inflating the strips into
+// it one at a time, so only a few buffers are ever held
+static int write_streamed(FILE *out, const struct data_IHDR *ref, const png_chunk_ref_t *plte,
+                          U32 height, stitch_strip_t *strips, int count) {
+    struct data_IHDR hdr = *ref;
+    hdr.height = height;
+    png_writer_t w;
+    if (!png_writer_begin(&w, out, &hdr, plte, Z_DEFAULT_COMPRESSION, 1)) {
+        fprintf(stderr, "Error: Compression failed\n");
+        return 0;
+    }
+    mem_ctx_t ctx;
+    int init = mem_inf_init(&ctx, 0);
+    for (int i = 0; i < count && w.ok; i++) {
+        if (!walk_strip(&strips[i], &w, init == Z_OK ? &ctx : NULL)) w.ok = 0;
+    }
+    if (init == Z_OK) mem_ctx_end(&ctx);
+    if (!png_writer_finish(&w)) {
+        fprintf(stderr, "Error: Writing the image failed\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Add a strip to the image's height and raw size, 0 when that would make
+// it taller than PNG allows or larger than memory can address
+static int stitch_grow(U32 *height, size_t *raw, U32 strip_height, size_t strip_size, const char *name) {
+    if (strip_height > PNG_DIM_MAX - *height || strip_size > SIZE_MAX - *raw) {
+        if (name) fprintf(stderr, "Warning: %s would make the image too large\n", name);
+        return 0;
+    }
+    *height += strip_height;
+    *raw += strip_size;
+    return 1;
+}
+
+// Stack strips top to bottom. The first pass checks every strip and sums
+// the exact filtered sizes, so the image is allocated once; then every
+// strip inflates concurrently straight into its own slot. The result is
+// deflated on threads as well. With one thread, or when the image does
+// not fit in memory, the strips are checked by a scan and then streamed
+// through a png_writer instead. With join the strips are only scanned, on
+// threads, and their deflate streams spliced together unchanged.
+int png_stitch(const png_view_t views[], const char *const names[], int n, FILE *out, int threads, int join) {
+    struct data_IHDR ref, hdr;
+    png_chunk_ref_t ref_plte, plte;
+    stitch_strip_t *strips = calloc(n > 0 ? n : 1, sizeof(*strips));
+    if (!strips) return -1;
+    size_t raw_total = 0;
+    U32 height_total = 0;
+    int valid = 0;
+    for (int i = 0; i < n; ++i) {
+        if (!stitch_check(&views[i], names ? names[i] : NULL, valid ? &ref : NULL,
+                          valid ? &ref_plte : NULL, &hdr, &plte) ||
+            !stitch_grow(&height_total, &raw_total, hdr.height, png_raw_size(&hdr), names ? names[i] : NULL)) {
             continue;
         }
+        if (valid == 0) {
+            ref = hdr;
+            ref_plte = plte;
+        }
+        stitch_strip_t *st = &strips[valid++];
+        st->view = &views[i];
+        st->name = names ? names[i] : NULL;
+        st->size = png_raw_size(&hdr);
+        st->offset = raw_total - st->size;
+        st->height = hdr.height;
+    }
+    if (valid == 0) {
+        free(strips);
+        return 0;
+    }
 
+    U8 *raw = NULL;
+    if (!join && threads > 1) {
+        raw = malloc(raw_total);
+    }
+    if (raw) {
+        run_strips(strips, valid, raw, threads, inflate_strip);
+    } else {
+        run_strips(strips, valid, NULL, threads, scan_strip);
+    }
 
-        // append raw strip data 
-        U8 *new_data = realloc(concat_data, concat_size + raw_len);
-        if (!new_data) {
-            free(raw);
-            free(concat_data);
-            free_png(png);
-            fclose(fp);
-            fclose(out);
-            return EXIT_FAILURE;
-            
+    // Drop strips that failed to inflate, closing the gaps they left
+    size_t raw_len = 0;
+    U32 total_height = 0;
+    int stitched = 0;
+    for (int i = 0; i < valid; ++i) {
+        stitch_strip_t *st = &strips[i];
+        if (!st->ok) {
+            if (st->name) fprintf(stderr, "Warning: Failed to decompress IDAT in %s\n", st->name);
+            continue;
+        }
+        if (raw && raw_len != st->offset) {
+            memmove(raw + raw_len, raw + st->offset, st->size);
         }
+        raw_len += st->size;
+        total_height += st->height;
+        strips[stitched++] = *st;
+    }
 
-        concat_data = new_data;
-        memcpy(concat_data + concat_size, raw, raw_len);
-        concat_size += raw_len;
-        total_height += ref_hdr.height; // add heigh of current strip
+    int ok = stitched == 0 ||
+             (join ? write_joined(out, &ref, &ref_plte, total_height, strips, stitched)
+              : raw ? write_stitched(out, &ref, &ref_plte, total_height, raw, raw_len, threads)
+                    : write_streamed(out, &ref, &ref_plte, total_height, strips, stitched));
+    free(strips);
+    free(raw);
+    return ok ? stitched : -1;
+}
 
-        free(raw);
-        free_png(png);
-        fclose(fp);
+// An input on its way through the png_stitch_files pipeline
+typedef struct {
+    png_view_t view;
+    const char *name;
+    struct data_IHDR hdr;
+    png_chunk_ref_t plte;
+    size_t size;
+    U8 *raw;
+    int first;              // the view the other palettes are checked against
+    int done;               // inflated, or failed to
+    int ok;
+} pipe_slot_t;
 
-    
-	}
+// Slots form a ring indexed by sequence number: the reader fills slot
+// read_seq, inflaters take inflate_seq and the writer frees write_seq, so
+// no more than nslots inputs are mapped or inflated at once
+typedef struct {
+    const char *const *paths;
+    int n;
+    pipe_slot_t *slots;
+    int nslots;
+    int read_seq;
+    int inflate_seq;
+    int write_seq;
+    int reader_done;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} stitch_pipe_t;
 
-    
-	struct chunk ihdr = {.length = DATA_IHDR_SIZE};
-	memcpy(ihdr.type, "IHDR", 4);
-	ihdr.p_data = malloc(DATA_IHDR_SIZE);
-	ihdr.p_data[0] = (ref_hdr.width >> 24) & 0xFF;
-	ihdr.p_data[1] = (ref_hdr.width >> 16) & 0xFF;
-	ihdr.p_data[2] = (ref_hdr.width >> 8) & 0xFF;
-	ihdr.p_data[3] = ref_hdr.width & 0xFF;
-	ihdr.p_data[4] = (total_height >> 24) & 0xFF;
-	ihdr.p_data[5] = (total_height >> 16) & 0xFF;
-	ihdr.p_data[6] = (total_height >> 8) & 0xFF;
-	ihdr.p_data[7] = total_height & 0xFF;
-	ihdr.p_data[8] = ref_hdr.bit_depth;
-	ihdr.p_data[9] = ref_hdr.color_type;
-	ihdr.p_data[10] = ref_hdr.compression;
-	ihdr.p_data[11] = ref_hdr.filter;
-	ihdr.p_data[12] = ref_hdr.interlace;
-    
-    // compute CRC for IHDR and write to file
-	ihdr.crc = crc((U8 *)ihdr.type, 4);
-	ihdr.crc = crc32(ihdr.crc, ihdr.p_data, ihdr.length);
-	write_chunk(out, &ihdr);
-	free(ihdr.p_data);
-
-
-
-    // compress and write IDAT to produce one IDAT chunk
-	U64 zlen = concat_size * 2;
-	U8 *zout = malloc(zlen);
-	if (!zout || mem_def(zout, &zlen, concat_data, concat_size, Z_DEFAULT_COMPRESSION) != Z_OK) {
-		fprintf(stderr, "Error: Compression failed\n");
-		free(zout);
-		free(concat_data);
-		fclose(out);
-		return EXIT_FAILURE;
-	}
+// Map, prefetch and check the inputs in order, handing the usable ones on
+static void *pipe_reader(void *arg) {
+    stitch_pipe_t *p = arg;
+    struct data_IHDR ref;
+    png_chunk_ref_t ref_plte;
+    int have_ref = 0;
+    for (int i = 0; i < p->n; ++i) {
+        png_view_t v;
+        if (!png_view_open(&v, p->paths[i])) {
+            fprintf(stderr, "Warning: Cannot open %s\n", p->paths[i]);
+            continue;
+        }
+        if (v.mapped) madvise((void *)v.data, v.len, MADV_WILLNEED);
+        struct data_IHDR hdr;
+        png_chunk_ref_t plte;
+        if (!stitch_check(&v, p->paths[i], have_ref ? &ref : NULL, have_ref ? &ref_plte : NULL, &hdr, &plte)) {
+            png_view_close(&v);
+            continue;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        while (p->read_seq - p->write_seq >= p->nslots) {
+            pthread_cond_wait(&p->changed, &p->lock);
+        }
+        pipe_slot_t *s = &p->slots[p->read_seq % p->nslots];
+        memset(s, 0, sizeof(*s));
+        s->view = v;
+        s->name = p->paths[i];
+        s->hdr = hdr;
+        s->plte = plte;
+        s->size = png_raw_size(&hdr);
+        s->first = !have_ref;
+        p->read_seq++;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+
+        if (!have_ref) {
+            ref = hdr;
+            ref_plte = plte;  // points into the first view, kept open to the end
+            have_ref = 1;
+        }
+    }
+    pthread_mutex_lock(&p->lock);
+    p->reader_done = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Inflate a slot taken off the ring with the thread's inflate stream, or
+// a new one when ctx is NULL; called without the lock held
+static void pipe_inflate(stitch_pipe_t *p, pipe_slot_t *s, mem_ctx_t *ctx) {
+    size_t got = s->size;
+    s->raw = malloc(s->size);
+    if (s->raw) {
+        int ret = ctx ? png_view_inflate_ctx(ctx, &s->view, s->raw, &got) : png_view_inflate(&s->view, s->raw, &got);
+        s->ok = ret == Z_OK && got == s->size;
+    }
+    pthread_mutex_lock(&p->lock);
+    s->done = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *pipe_inflater(void *arg) {
+    stitch_pipe_t *p = arg;
+    mem_ctx_t ctx;
+    int init = mem_inf_init(&ctx, 0);
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->inflate_seq == p->read_seq && !p->reader_done) {
+            pthread_cond_wait(&p->changed, &p->lock);
+        }
+        if (p->inflate_seq == p->read_seq) break;
+        pipe_slot_t *s = &p->slots[p->inflate_seq++ % p->nslots];
+        pthread_mutex_unlock(&p->lock);
+        pipe_inflate(p, s, init == Z_OK ? &ctx : NULL);
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (init == Z_OK) mem_ctx_end(&ctx);
+    return NULL;
+}
+
+// The same stitch as png_stitch, run as a pipeline so reading, inflating
+// and deflating overlap: a reader thread maps and checks the files ahead
+// of time, threads inflaters fill a ring of slots and the caller takes
+// them in order into a png_writer, inflating too while it would otherwise
+// wait. Memory is bounded by the ring, not the number of inputs. The
+// height is only known at the end, so the IHDR is rewritten then.
+int png_stitch_files(const char *const paths[], int n, FILE *out, int threads) {
+    stitch_pipe_t p = { .paths = paths, .n = n };
+    if (threads < 1) threads = 1;
+    p.nslots = 2 * threads + 2;
+    p.slots = calloc(p.nslots, sizeof(*p.slots));
+    pthread_t *tids = malloc((threads + 1) * sizeof(*tids));
+    if (!p.slots || !tids) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        free(p.slots);
+        free(tids);
+        return -1;
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+    if (pthread_create(&tids[0], NULL, pipe_reader, &p) != 0) {
+        fprintf(stderr, "Error: Cannot start the reader thread\n");
+        pthread_cond_destroy(&p.changed);
+        pthread_mutex_destroy(&p.lock);
+        free(p.slots);
+        free(tids);
+        return -1;
+    }
+    int started = 1;
+    while (started < threads + 1 && pthread_create(&tids[started], NULL, pipe_inflater, &p) == 0) {
+        started++;
+    }
 
-    // construct and write IDAT chunk
-	struct chunk idat = {.length = zlen};
-	memcpy(idat.type, "IDAT", 4);
-	idat.p_data = zout;
-    idat.crc = calculate_chunk_crc(&idat);
-	write_chunk(out, &idat);
-	free(idat.p_data);
+    png_writer_t w;
+    png_view_t first_view = {0};
+    mem_ctx_t ctx;  // for the slots the caller inflates itself
+    int init = mem_inf_init(&ctx, 0);
+    int writing = 0, failed = 0, stitched = 0;
+    U32 total_height = 0;
+    size_t total_raw = 0;
+    pthread_mutex_lock(&p.lock);
+    for (;;) {
+        pipe_slot_t *s = &p.slots[p.write_seq % p.nslots];
+        if (p.write_seq < p.read_seq && s->done) {
+            pthread_mutex_unlock(&p.lock);
+            if (!s->ok) {
+                fprintf(stderr, "Warning: Failed to decompress IDAT in %s\n", s->name);
+            } else if (!failed && stitch_grow(&total_height, &total_raw, s->hdr.height, s->size, s->name)) {
+                if (!writing && !png_writer_begin(&w, out, &s->hdr, &s->plte, Z_DEFAULT_COMPRESSION, threads)) {
+                    fprintf(stderr, "Error: Compression failed\n");
+                    failed = 1;
+                } else {
+                    writing = 1;
+                    png_writer_append(&w, s->raw, s->size);
+                    stitched++;
+                }
+            }
+            free(s->raw);
+            if (s->first) {
+                first_view = s->view;
+            } else {
+                png_view_close(&s->view);
+            }
+            pthread_mutex_lock(&p.lock);
+            s->done = 0;
+            p.write_seq++;
+            pthread_cond_broadcast(&p.changed);
+        } else if (p.inflate_seq < p.read_seq) {
+            pipe_slot_t *t = &p.slots[p.inflate_seq++ % p.nslots];
+            pthread_mutex_unlock(&p.lock);
+            pipe_inflate(&p, t, init == Z_OK ? &ctx : NULL);
+            pthread_mutex_lock(&p.lock);
+        } else if (p.reader_done && p.write_seq == p.read_seq) {
+            break;
+        } else {
+            pthread_cond_wait(&p.changed, &p.lock);
+        }
+    }
+    pthread_mutex_unlock(&p.lock);
 
-    // write final IEND chunk to close PNG
-	struct chunk iend = {.length = 0, .p_data = NULL};
-	memcpy(iend.type, "IEND", 4);
-	iend.crc = calculate_chunk_crc(&iend);
-	write_chunk(out, &iend);
+    for (int k = 0; k < started; k++) {
+        pthread_join(tids[k], NULL);
+    }
+    if (writing) {
+        int height_ok = png_writer_set_height(&w, total_height);
+        if (!png_writer_finish(&w) || !height_ok) {
+            fprintf(stderr, "Error: Writing the image failed\n");
+            failed = 1;
+        }
+    }
+    png_view_close(&first_view);
+    if (init == Z_OK) mem_ctx_end(&ctx);
+    pthread_cond_destroy(&p.changed);
+    pthread_mutex_destroy(&p.lock);
+    free(p.slots);
+    free(tids);
+    return failed ? -1 : stitched;
+}
 
+// save a complete PNG assembled from 50 PNG strip buffers, joining their
+// compressed data as is when join is set
+int save_png_from_memstrips(const unsigned char *data[], const size_t sizes[], const char *filename, int join) { // Reusing from some part of catpng.c
+	FILE *out = fopen(filename, "wb");
+	if (!out) {
+		fprintf(stderr, "Error: Cannot create all.png\n");
+		return EXIT_FAILURE;
+	}
+
+    // view each strip in place
+	png_view_t views[50];
+	for (int i = 0; i < 50; ++i) {
+		png_view_mem(&views[i], data[i], sizes[i]);
+	}
+	int stitched = png_stitch(views, NULL, 50, out, (int)sysconf(_SC_NPROCESSORS_ONLN), join);
 
-    // cleanup
-	free(concat_data);
 	fclose(out);
-	return EXIT_SUCCESS;
+	return stitched > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,74 @@
+/**
+ * @file: mpmc_queue.c
+ * @brief: bounded lock-free MPMC queue, see mpmc_queue.h
+ *
+ * Cell i starts with seq == i. A producer at position pos owns the cell when
+ * seq == pos and publishes with seq = pos + 1; a consumer at pos owns it when
+ * seq == pos + 1 and frees it for the next lap with seq = pos + capacity.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "mpmc_queue.h"
+
+int mpmc_init(mpmc_queue_t *q, size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    q->cells = malloc(n * sizeof(mpmc_cell_t));
+    if (!q->cells) return 0;
+    for (size_t i = 0; i < n; i++) {
+        atomic_init(&q->cells[i].seq, i);
+        q->cells[i].item = NULL;
+    }
+    q->mask = n - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return 1;
+}
+
+void mpmc_destroy(mpmc_queue_t *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+int mpmc_push(mpmc_queue_t *q, void *item) {
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        mpmc_cell_t *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;  // a lap behind: full
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+void *mpmc_pop(mpmc_queue_t *q) {
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        mpmc_cell_t *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                void *item = cell->item;
+                atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+                return item;
+            }
+        } else if (diff < 0) {
+            return NULL;  // nothing published here yet: empty
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
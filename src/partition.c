@@ -0,0 +1,139 @@
+/**
+ * @file: partition.c
+ * @brief: host-hash partitioning and coordinator/worker transport, see partition.h
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "partition.h"
+
+unsigned partition_of(const char *url, unsigned nparts) {
+    if (nparts <= 1 || !url) return 0;
+    const char *host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    size_t host_len = strcspn(host, ":/?#");
+
+    // FNV-1a over the lowercased host, so every URL of a host lands together
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < host_len; i++) {
+        h ^= (unsigned char)tolower((unsigned char)host[i]);
+        h *= 0x100000001b3ULL;
+    }
+    return (unsigned)(h % nparts);
+}
+
+// write() until everything is out
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Format one message into line, its length or 0 if it does not fit
+static size_t format_line(char line[PART_LINE_MAX], char kind, const char *payload) {
+    int len = snprintf(line, PART_LINE_MAX, "%c %s\n", kind, payload ? payload : "");
+    if (len < 0 || len >= PART_LINE_MAX) return 0;
+    return (size_t)len;
+}
+
+int part_send(int fd, pthread_mutex_t *lock, char kind, const char *payload) {
+    char line[PART_LINE_MAX];
+    size_t len = format_line(line, kind, payload);
+    if (len == 0) return 0;
+
+    if (lock) pthread_mutex_lock(lock);
+    int ok = write_all(fd, line, len);
+    if (lock) pthread_mutex_unlock(lock);
+    return ok;
+}
+
+void part_reader_init(part_reader_t *r, int fd) {
+    r->fd = fd;
+    r->len = 0;
+}
+
+int part_reader_fill(part_reader_t *r) {
+    if (r->len == sizeof(r->buf)) {
+        r->len = 0;  // no newline in a full buffer: drop the garbage
+    }
+    for (;;) {
+        ssize_t n = read(r->fd, r->buf + r->len, sizeof(r->buf) - r->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        r->len += n;
+        return 1;
+    }
+}
+
+int part_reader_next(part_reader_t *r, char *kind, char *payload, size_t payload_len) {
+    char *nl = memchr(r->buf, '\n', r->len);
+    if (!nl) return 0;
+    size_t line_len = nl - r->buf;
+
+    *kind = line_len > 0 ? r->buf[0] : '\0';
+    size_t off = line_len >= 2 ? 2 : line_len;
+    size_t n = line_len - off;
+    if (n >= payload_len) n = payload_len - 1;
+    memcpy(payload, r->buf + off, n);
+    payload[n] = '\0';
+
+    r->len -= line_len + 1;
+    memmove(r->buf, nl + 1, r->len);
+    return 1;
+}
+
+int part_outbuf_put(part_outbuf_t *b, char kind, const char *payload) {
+    char line[PART_LINE_MAX];
+    size_t len = format_line(line, kind, payload);
+    if (len == 0) return 0;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : PART_LINE_MAX * 4;
+        while (cap < b->len + len) cap *= 2;
+        char *data = realloc(b->data, cap);
+        if (!data) return 0;
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, line, len);
+    b->len += len;
+    return 1;
+}
+
+int part_outbuf_flush(part_outbuf_t *b, int fd, int block) {
+    size_t off = 0;
+    while (off < b->len) {
+        ssize_t n = send(fd, b->data + off, b->len - off, block ? MSG_NOSIGNAL : MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (!block && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            b->len = 0;  // the peer is gone, nothing queued can reach it
+            return 0;
+        }
+        off += n;
+    }
+    if (off > 0) {
+        b->len -= off;
+        memmove(b->data, b->data + off, b->len);
+    }
+    return 1;
+}
+
+void part_outbuf_free(part_outbuf_t *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
@@ -107,22 +107,15 @@ void *thread_fn(void *arg) {
 
 
 int decompress_strip(const unsigned char *png_data, size_t size, unsigned char *out_buffer) {
-    simple_PNG_p strip = mallocPNG();
-    FILE *fp = fmemopen((void *)png_data, size, "rb");
-    if (!fp || !get_png_chunks(strip, fp, 0, SEEK_SET)) {
-        fprintf(stderr, "Failed to parse PNG strip.\n");
-        return 0;
-    }
-
-    uLongf out_len = 400 * 6 + 6; // data size = 6 scamlines + 6 filter bytes
-    int res = uncompress(out_buffer, &out_len, strip->p_IDAT->p_data, strip->p_IDAT->length);
+    // inflate the strip's IDAT data where it lies
+    png_view_t strip;
+    png_view_mem(&strip, png_data, size);
+    size_t out_len = 400 * 6 + 6; // data size = 6 scamlines + 6 filter bytes
+    int res = png_view_inflate(&strip, out_buffer, &out_len);
     if (res != Z_OK) {
-        fprintf(stderr, "uncompressed() failed: %d\n", res);
+        fprintf(stderr, "Failed to decompress PNG strip: %d\n", res);
         return 0;
     }
-
-    fclose(fp);
-    free_png(strip);
     return 1;
 
 }
@@ -132,11 +125,12 @@ int decompress_strip(const unsigned char *png_data, size_t size, unsigned char *
 int main(int argc, char *argv[]) {
     int num_threads = 1;
     int image_num = 1;
+    int join = 0;
     int opt;
     char *str = "option requires an argument";
 
     // Parse command-line arguments
-    while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+    while ((opt = getopt(argc, argv, "t:n:j")) != -1) {
 
         switch (opt) {
             case 't': // number of threads
@@ -155,6 +149,9 @@ int main(int argc, char *argv[]) {
                     return EXIT_FAILURE;
                 }
                 break;
+            case 'j': // join the strips' compressed data instead of recompressing
+                join = 1;
+                break;
             default:
                 return EXIT_FAILURE;
         }
@@ -180,7 +177,7 @@ int main(int argc, char *argv[]) {
     }
 
     // save the final assembled image to all.png
-    if (save_png_from_memstrips((const unsigned char **)shared.data, shared.sizes, "all.png")) {
+    if (save_png_from_memstrips((const unsigned char **)shared.data, shared.sizes, "all.png", join)) {
         
         fprintf(stderr, "Failed to save all.png\n");
     } else {
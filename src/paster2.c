@@ -83,9 +83,9 @@ void producer(shared_buf_t *shm, int B, int imgN) {
         int id = shm->next_id++;
         sem_post(mutex);
 
-        // download strip 'id'
+        // download strip 'id' straight into its shared slot, no other producer writes it
         curl_data_t cd = {
-            .buf     = malloc(MAX_SEGMENT_SIZE),
+            .buf     = shm->data[id],
             .sz      = 0,
             .frag_id = -1
         };
@@ -100,11 +100,9 @@ void producer(shared_buf_t *shm, int B, int imgN) {
         curl_easy_setopt(curl, CURLOPT_WRITEDATA,      &cd);
         curl_easy_perform(curl);
 
-        // store compressed data
-        memcpy(shm->data[id], cd.buf, cd.sz);
+        // record compressed data
         shm->sizes[id]    = cd.sz;
         shm->received[id] = 1;
-        free(cd.buf);
 
         // enqueue id
         sem_wait(empty);
@@ -138,8 +136,15 @@ void consumer(shared_buf_t *shm, int B, int delay_ms) {
 }
 
 int main(int argc, char *argv[]) {
+    // -j: join the strips' compressed data instead of recompressing
+    int join = 0;
+    if (argc > 1 && strcmp(argv[1], "-j") == 0) {
+        join = 1;
+        argv++;
+        argc--;
+    }
     if (argc != 6) {
-        fprintf(stderr, "Usage: %s <B> <P> <C> <X> <N>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-j] <B> <P> <C> <X> <N>\n", argv[0]);
         return EXIT_FAILURE;
     }
     int B = atoi(argv[1]),
@@ -216,7 +221,7 @@ int main(int argc, char *argv[]) {
         data_ptrs[i] = shm->data[i];
         sizes[i]     = shm->sizes[i];
     }
-    if (save_png_from_memstrips(data_ptrs, sizes, "all.png"))
+    if (save_png_from_memstrips(data_ptrs, sizes, "all.png", join))
         fprintf(stderr, "Error writing all.png\n");
 
     gettimeofday(&t1, NULL);
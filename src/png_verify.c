@@ -0,0 +1,217 @@
+/**
+ * @file: png_verify.c
+ * @brief: streaming PNG structure check, see png_verify.h
+ *
+ * Chunk CRCs are computed with update_crc from crc.c as the data goes by,
+ * the incremental form of calculate_chunk_crc in lab_png.c. Bytes after
+ * IEND and after the end of the zlib stream are ignored, as libpng does.
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "png_verify.h"
+#include "crc.h"
+
+#define INFLATE_SCRATCH 4096       // inflated bytes are counted, then dropped
+#define CHUNK_LENGTH_MAX 0x7fffffffUL
+
+enum { PV_SIG, PV_LENGTH, PV_TYPE, PV_DATA, PV_CRC, PV_DONE, PV_ERROR };
+
+static const unsigned char png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    make_crc_table();
+}
+
+static int fail(png_verify_t *v, const char *why) {
+    v->state = PV_ERROR;
+    v->error = why;
+    return 0;
+}
+
+static unsigned long be32(const unsigned char *p) {
+    return (unsigned long)p[0] << 24 | (unsigned long)p[1] << 16 | (unsigned long)p[2] << 8 | p[3];
+}
+
+// Filtered bytes of a w x h image: a filter byte plus the packed pixels per row
+static unsigned long long rows_size(unsigned long w, unsigned long h, unsigned bits) {
+    if (w == 0 || h == 0) return 0;
+    return (unsigned long long)h * (1 + ((unsigned long long)w * bits + 7) / 8);
+}
+
+// Size of the inflated image data, summed over the seven passes when interlaced
+static unsigned long long raw_size(unsigned long w, unsigned long h, unsigned bits, int interlace) {
+    if (!interlace) return rows_size(w, h, bits);
+    static const unsigned x0[7] = {0, 4, 0, 2, 0, 1, 0}, dx[7] = {8, 8, 4, 4, 2, 2, 1};
+    static const unsigned y0[7] = {0, 0, 4, 0, 2, 0, 1}, dy[7] = {8, 8, 8, 4, 4, 2, 2};
+    unsigned long long size = 0;
+    for (int i = 0; i < 7; i++) {
+        unsigned long pw = w > x0[i] ? (w - x0[i] + dx[i] - 1) / dx[i] : 0;
+        unsigned long ph = h > y0[i] ? (h - y0[i] + dy[i] - 1) / dy[i] : 0;
+        size += rows_size(pw, ph, bits);
+    }
+    return size;
+}
+
+// Validate the IHDR fields and derive the inflated size
+static int check_ihdr(png_verify_t *v) {
+    const unsigned char *d = v->ihdr;
+    unsigned long width = be32(d), height = be32(d + 4);
+    unsigned depth = d[8], color = d[9];
+    if (width == 0 || height == 0 || width > CHUNK_LENGTH_MAX || height > CHUNK_LENGTH_MAX) {
+        return fail(v, "bad image size");
+    }
+    unsigned channels;
+    int depth_ok;
+    switch (color) {
+        case 0: channels = 1; depth_ok = depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16; break;
+        case 3: channels = 1; depth_ok = depth == 1 || depth == 2 || depth == 4 || depth == 8; break;
+        case 2: channels = 3; depth_ok = depth == 8 || depth == 16; break;
+        case 4: channels = 2; depth_ok = depth == 8 || depth == 16; break;
+        case 6: channels = 4; depth_ok = depth == 8 || depth == 16; break;
+        default: return fail(v, "bad color type");
+    }
+    if (!depth_ok) return fail(v, "bad bit depth");
+    if (d[10] != 0 || d[11] != 0 || d[12] > 1) return fail(v, "bad compression, filter or interlace method");
+    v->raw_expected = raw_size(width, height, channels * depth, d[12]);
+    return 1;
+}
+
+// Inflate a piece of IDAT data into scratch space, counting what comes out
+static int inflate_idat(png_verify_t *v, const unsigned char *p, size_t n) {
+    if (v->z_end) return 1;
+    unsigned char out[INFLATE_SCRATCH];
+    v->zs.next_in = (Bytef *)p;
+    v->zs.avail_in = (uInt)n;
+    do {
+        v->zs.next_out = out;
+        v->zs.avail_out = sizeof(out);
+        int rc = inflate(&v->zs, Z_NO_FLUSH);
+        v->raw_seen += sizeof(out) - v->zs.avail_out;
+        if (v->raw_seen > v->raw_expected) return fail(v, "more image data than the IHDR describes");
+        if (rc == Z_STREAM_END) {
+            v->z_end = 1;
+        } else if (rc == Z_BUF_ERROR) {
+            break;  // no progress: the output filled scratch exactly as the input ran out
+        } else if (rc != Z_OK) {
+            return fail(v, "corrupt zlib stream");
+        }
+    } while (!v->z_end && (v->zs.avail_in > 0 || v->zs.avail_out == 0));
+    return 1;
+}
+
+// A chunk's length and type are in: check it may come here
+static int chunk_begin(png_verify_t *v) {
+    const unsigned char *t = v->type;
+    int is_idat = memcmp(t, "IDAT", 4) == 0;
+    if (!v->seen_ihdr && memcmp(t, "IHDR", 4) != 0) return fail(v, "IHDR is not the first chunk");
+    if (memcmp(t, "IHDR", 4) == 0) {
+        if (v->seen_ihdr) return fail(v, "second IHDR");
+        if (v->length != sizeof(v->ihdr)) return fail(v, "bad IHDR length");
+    } else if (memcmp(t, "PLTE", 4) == 0) {
+        if (v->seen_idat) return fail(v, "PLTE after IDAT");
+        if (v->length == 0 || v->length % 3 != 0 || v->length > 256 * 3) return fail(v, "bad PLTE length");
+        v->seen_plte = 1;
+    } else if (is_idat) {
+        if (v->seen_idat && !v->in_idat) return fail(v, "IDAT chunks are not consecutive");
+        if (v->ihdr[9] == 3 && !v->seen_plte) return fail(v, "palette image without PLTE");
+        v->seen_idat = 1;
+    } else if (memcmp(t, "IEND", 4) == 0) {
+        if (v->length != 0) return fail(v, "bad IEND length");
+        if (!v->seen_idat) return fail(v, "no IDAT");
+    } else if (isupper(t[0])) {
+        return fail(v, "unknown critical chunk");
+    }
+    v->in_idat = is_idat;
+    return 1;
+}
+
+int png_verify_init(png_verify_t *v) {
+    pthread_once(&crc_once, crc_table_init);
+    memset(v, 0, sizeof(*v));
+    if (inflateInit(&v->zs) != Z_OK) return 0;
+    return 1;
+}
+
+void png_verify_reset(png_verify_t *v) {
+    z_stream zs = v->zs;
+    memset(v, 0, sizeof(*v));
+    v->zs = zs;
+    inflateReset(&v->zs);
+}
+
+void png_verify_destroy(png_verify_t *v) {
+    inflateEnd(&v->zs);
+}
+
+int png_verify_feed(png_verify_t *v, const void *data, size_t n) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + n;
+    while (p < end && v->state != PV_DONE && v->state != PV_ERROR) {
+        switch (v->state) {
+            case PV_SIG:
+                if (*p++ != png_signature[v->pos]) return fail(v, "bad signature");
+                if (++v->pos == sizeof(png_signature)) {
+                    v->state = PV_LENGTH;
+                    v->pos = v->length = 0;
+                }
+                break;
+            case PV_LENGTH:
+                v->length = v->length << 8 | *p++;
+                if (++v->pos == 4) {
+                    if (v->length > CHUNK_LENGTH_MAX) return fail(v, "bad chunk length");
+                    v->state = PV_TYPE;
+                    v->pos = 0;
+                }
+                break;
+            case PV_TYPE:
+                if (!isalpha(*p)) return fail(v, "bad chunk type");
+                v->type[v->pos] = *p++;
+                if (++v->pos == 4) {
+                    if (!chunk_begin(v)) return 0;
+                    v->crc = update_crc(0xffffffffUL, v->type, 4);
+                    v->state = v->length ? PV_DATA : PV_CRC;
+                    v->pos = v->stored_crc = 0;
+                }
+                break;
+            case PV_DATA: {
+                size_t take = (size_t)(end - p);
+                if (take > v->length - v->pos) take = v->length - v->pos;
+                v->crc = update_crc(v->crc, (unsigned char *)p, (int)take);
+                if (v->in_idat && !inflate_idat(v, p, take)) return 0;
+                if (memcmp(v->type, "IHDR", 4) == 0) memcpy(v->ihdr + v->pos, p, take);
+                p += take;
+                v->pos += take;
+                if (v->pos == v->length) {
+                    v->state = PV_CRC;
+                    v->pos = v->stored_crc = 0;
+                }
+                break;
+            }
+            case PV_CRC:
+                v->stored_crc = v->stored_crc << 8 | *p++;
+                if (++v->pos == 4) {
+                    if (v->stored_crc != (v->crc ^ 0xffffffffUL)) return fail(v, "chunk CRC mismatch");
+                    if (memcmp(v->type, "IHDR", 4) == 0) {
+                        if (!check_ihdr(v)) return 0;
+                        v->seen_ihdr = 1;
+                    }
+                    v->state = memcmp(v->type, "IEND", 4) == 0 ? PV_DONE : PV_LENGTH;
+                    v->pos = v->length = 0;
+                }
+                break;
+        }
+    }
+    return v->state != PV_ERROR;
+}
+
+int png_verify_finish(png_verify_t *v) {
+    if (v->state == PV_ERROR) return 0;
+    if (v->state != PV_DONE) return fail(v, "truncated");
+    if (!v->z_end) return fail(v, "truncated zlib stream");
+    if (v->raw_seen != v->raw_expected) return fail(v, "less image data than the IHDR describes");
+    return 1;
+}
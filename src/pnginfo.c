@@ -10,49 +10,44 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    FILE *fp = fopen(argv[1], "rb");
-    if (!fp) {
+    png_view_t view;
+    if (!png_view_open(&view, argv[1])) {
         fprintf(stderr, "%s: Unable to open file\n", argv[1]);
         return EXIT_FAILURE;
     }
 
     // Check PNG signature
-    U8 sig[PNG_SIG_SIZE];
-    if (fread(sig, 1, PNG_SIG_SIZE, fp) != PNG_SIG_SIZE || !is_png(sig, PNG_SIG_SIZE)) {
+    png_chunk_iter_t it;
+    if (!png_chunk_iter_init(&it, &view)) {
         printf("%s: Not a PNG file\n", argv[1]);
-        fclose(fp);
+        png_view_close(&view);
         return EXIT_SUCCESS;
     }
 
     // Get IHDR data
     struct data_IHDR ihdr;
-    if (!get_png_data_IHDR(&ihdr, fp, 0, SEEK_SET)) {
+    if (!png_view_IHDR(&ihdr, &view)) {
         fprintf(stderr, "%s: Invalid IHDR chunk\n", argv[1]);
-        fclose(fp);
+        png_view_close(&view);
         return EXIT_FAILURE;
     }
-
-    // Get all chunks
-    simple_PNG_p png = mallocPNG();
-    if (!png || !get_png_chunks(png, fp, 0, SEEK_SET)) {
+    printf("%s: %u x %u\n", argv[1], ihdr.width, ihdr.height);
+
+    // Check the CRC of every chunk in place
+    png_chunk_ref_t c;
+    while (png_chunk_next(&it, &c)) {
+        U32 computed_crc = png_chunk_calc_crc(&c);
+        if (computed_crc != c.crc) {
+            printf("%.4s chunk CRC error: computed %08x, expected %08x\n", (const char *)c.type, computed_crc, c.crc);
+            break;
+        }
+    }
+    if (it.truncated) {
         fprintf(stderr, "%s: Failed to read PNG chunks\n", argv[1]);
-        free_png(png);
-        fclose(fp);
+        png_view_close(&view);
         return EXIT_FAILURE;
     }
 
-    // Check IDAT CRC
-    U32 expected_crc = get_chunk_crc(png->p_IDAT);
-    U32 computed_crc = calculate_chunk_crc(png->p_IDAT);
-
-    if (expected_crc != computed_crc) {
-        printf("%s: %u x %u\n", argv[1], ihdr.width, ihdr.height);
-        printf("IDAT chunk CRC error: computed %08x, expected %08x\n", computed_crc, expected_crc);
-    } else {
-        printf("%s: %u x %u\n", argv[1], ihdr.width, ihdr.height);
-    }
-
-    free_png(png);
-    fclose(fp);
+    png_view_close(&view);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
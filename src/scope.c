@@ -0,0 +1,198 @@
+/**
+ * @file: scope.c
+ * @brief: crawl scope tries, see scope.h
+ *
+ * A trie is an array of nodes linked by index (first child, next sibling),
+ * so growing it is one realloc and a walk touches only a few cache lines.
+ * Hosts and extensions are matched case-insensitively, paths exactly.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "scope.h"
+
+static unsigned trie_child(const scope_trie_t *t, unsigned node, unsigned char c) {
+    for (unsigned i = t->nodes[node].first_child; i; i = t->nodes[i].next_sibling) {
+        if (t->nodes[i].c == c) return i;
+    }
+    return 0;
+}
+
+static unsigned trie_new_node(scope_trie_t *t, unsigned char c) {
+    if (t->count == t->capacity) {
+        unsigned capacity = t->capacity ? t->capacity * 2 : 64;
+        scope_node_t *nodes = realloc(t->nodes, capacity * sizeof(*nodes));
+        if (!nodes) return 0;
+        t->nodes = nodes;
+        t->capacity = capacity;
+    }
+    scope_node_t *n = &t->nodes[t->count];
+    n->c = c;
+    n->verdict = 0;
+    n->first_child = n->next_sibling = 0;
+    return t->count++;
+}
+
+// Add key, read backwards when reversed, ending in verdict; a later rule for
+// the same key replaces the earlier one
+static int trie_insert(scope_trie_t *t, const char *key, size_t len, int reversed, int fold, int verdict) {
+    if (t->count == 0) {
+        trie_new_node(t, 0);  // the root is node 0
+        if (t->count == 0) return 0;
+    }
+    unsigned node = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)key[reversed ? len - 1 - i : i];
+        if (fold) c = (unsigned char)tolower(c);
+        unsigned child = trie_child(t, node, c);
+        if (!child) {
+            child = trie_new_node(t, c);
+            if (!child) return 0;
+            t->nodes[child].next_sibling = t->nodes[node].first_child;
+            t->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+    t->nodes[node].verdict = (signed char)verdict;
+    if (verdict > 0) t->has_allow = 1;
+    return 1;
+}
+
+static void trie_free(scope_trie_t *t) {
+    free(t->nodes);
+    memset(t, 0, sizeof(*t));
+}
+
+void scope_init(scope_t *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+void scope_destroy(scope_t *s) {
+    trie_free(&s->hosts);
+    trie_free(&s->paths);
+    trie_free(&s->exts);
+    scope_init(s);
+}
+
+int scope_add_domain(scope_t *s, const char *suffix, int allow) {
+    // "*.example.com" and ".example.com" mean the same as "example.com"
+    if (strncmp(suffix, "*.", 2) == 0) suffix += 2;
+    while (*suffix == '.') suffix++;
+    size_t len = strlen(suffix);
+    if (len == 0) return 0;
+    s->active = 1;
+    return trie_insert(&s->hosts, suffix, len, 1, 1, allow ? 1 : -1);
+}
+
+int scope_add_path(scope_t *s, const char *prefix, int allow) {
+    if (prefix[0] != '/') return 0;
+    s->active = 1;
+    return trie_insert(&s->paths, prefix, strlen(prefix), 0, 0, allow ? 1 : -1);
+}
+
+int scope_add_ext(scope_t *s, const char *ext) {
+    char key[32];
+    while (*ext == '.') ext++;
+    size_t len = strlen(ext);
+    if (len == 0 || len + 1 >= sizeof(key)) return 0;
+    key[0] = '.';
+    memcpy(key + 1, ext, len);
+    s->active = 1;
+    return trie_insert(&s->exts, key, len + 1, 1, 1, -1);
+}
+
+void scope_set_max_depth(scope_t *s, unsigned depth) {
+    s->max_depth = depth;
+    if (depth) s->active = 1;
+}
+
+// Verdict of the most specific host rule on a label boundary
+static int host_verdict(const scope_trie_t *t, const char *host, size_t len) {
+    if (t->count == 0) return 0;
+    int verdict = 0;
+    unsigned node = 0;
+    for (size_t i = len; i-- > 0;) {
+        node = trie_child(t, node, (unsigned char)tolower((unsigned char)host[i]));
+        if (!node) break;
+        if (t->nodes[node].verdict && (i == 0 || host[i - 1] == '.')) {
+            verdict = t->nodes[node].verdict;
+        }
+    }
+    return verdict;
+}
+
+// Verdict of the longest matching path prefix
+static int path_verdict(const scope_trie_t *t, const char *path, size_t len) {
+    if (t->count == 0) return 0;
+    int verdict = 0;
+    unsigned node = 0;
+    for (size_t i = 0; i < len; i++) {
+        node = trie_child(t, node, (unsigned char)path[i]);
+        if (!node) break;
+        if (t->nodes[node].verdict) verdict = t->nodes[node].verdict;
+    }
+    return verdict;
+}
+
+// 1 if the last path segment ends in an excluded extension
+static int ext_excluded(const scope_trie_t *t, const char *path, size_t len) {
+    if (t->count == 0) return 0;
+    unsigned node = 0;
+    for (size_t i = len; i-- > 0 && path[i] != '/';) {
+        node = trie_child(t, node, (unsigned char)tolower((unsigned char)path[i]));
+        if (!node) return 0;
+        if (t->nodes[node].verdict) return 1;
+    }
+    return 0;
+}
+
+int scope_allows(const scope_t *s, const char *url, size_t len) {
+    if (!s->active) return 1;
+    const char *end = url + len;
+    const char *host = NULL;
+    for (const char *p = url; p + 3 <= end; p++) {
+        if (p[0] == ':' && p[1] == '/' && p[2] == '/') {
+            host = p + 3;
+            break;
+        }
+        if (!isalpha((unsigned char)*p)) break;
+    }
+    if (!host) return 0;
+
+    // Authority: drop user info and port
+    const char *path = host;
+    while (path < end && *path != '/' && *path != '?' && *path != '#') path++;
+    for (const char *p = host; p < path; p++) {
+        if (*p == '@') host = p + 1;
+    }
+    const char *host_end = host;
+    while (host_end < path && *host_end != ':') host_end++;
+
+    int verdict = host_verdict(&s->hosts, host, (size_t)(host_end - host));
+    if (verdict < 0 || (verdict == 0 && s->hosts.has_allow)) return 0;
+
+    // Path up to the fragment for prefixes, up to the query for the rest
+    const char *frag = path;
+    while (frag < end && *frag != '#') frag++;
+    const char *query = path;
+    while (query < frag && *query != '?') query++;
+    if (path == query) {
+        // No path at all is the root path
+        verdict = path_verdict(&s->paths, "/", 1);
+    } else {
+        verdict = path_verdict(&s->paths, path, (size_t)(frag - path));
+    }
+    if (verdict < 0 || (verdict == 0 && s->paths.has_allow)) return 0;
+
+    if (ext_excluded(&s->exts, path, (size_t)(query - path))) return 0;
+
+    if (s->max_depth) {
+        unsigned depth = 0;
+        for (const char *p = path; p < query; p++) {
+            if (*p != '/' && (p == path || p[-1] == '/')) depth++;
+        }
+        if (depth > s->max_depth) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,755 @@
+/**
+ * @file: uring_http.c
+ * @brief: minimal HTTP/1.1 GET client on io_uring, see uring_http.h
+ *
+ * The ring is driven through the raw system calls. Every slot has at most
+ * one operation in flight, linked to a LINK_TIMEOUT, so the submission
+ * queue never needs more than two entries per slot, plus one for the
+ * resolver's wakeup.
+ *
+ * getaddrinfo blocks on a name, so names are looked up on a few resolver
+ * threads per client; numeric addresses are converted in place. A slot
+ * waits in SLOT_RESOLVE meanwhile and a resolver hands it back through a
+ * done list and an eventfd the ring keeps a read on, so a slow lookup
+ * holds up only its own request. Addresses are cached per client, and a
+ * slot fetching from the host it last used needs no lookup.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+#include "uring_http.h"
+
+#define UHTTP_HOST_MAX    256
+#define UHTTP_REQ_MAX     4096
+#define UHTTP_TIMEOUT_TAG (~0ULL)  // user_data of link timeouts, their CQEs are ignored
+#define UHTTP_WAKE_TAG    (~0ULL - 1)  // user_data of the read on the resolver's eventfd
+#define UHTTP_DNS_CACHE   64   // resolved host:port pairs kept per client
+#define UHTTP_RESOLVERS   4    // lookups in progress at once per client
+
+enum { SLOT_IDLE, SLOT_RESOLVE, SLOT_CONNECT, SLOT_SEND, SLOT_RECV, SLOT_DONE };
+
+typedef struct {
+    int state;
+    int fd;                           // connection, -1 when closed
+    int reused;                       // current request went out on a kept alive connection
+    char host[UHTTP_HOST_MAX];        // host and port of the request and resolved address
+    char port[8];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;               // 0 when unknown; written by the resolver in SLOT_RESOLVE
+    char req[UHTTP_REQ_MAX];
+    size_t req_len, req_sent;
+    char *buf;                        // registered receive buffer, buf_size + 1 bytes
+    size_t len;
+    size_t hdr_len;                   // 0 until the header block is complete
+    long content_length;              // -1 when the body runs to EOF
+    int keep_alive;
+    long status;
+    int outcome;
+    void *user;
+    long connect_ms, timeout_ms;      // limits for the connect and for each send or receive
+    struct __kernel_timespec timeout;
+} slot_t;
+
+// Idle kept alive connection, shared by all slots of a client
+typedef struct {
+    int fd;
+    char host[UHTTP_HOST_MAX];
+    char port[8];
+} idle_conn_t;
+
+typedef struct {
+    char host[UHTTP_HOST_MAX];
+    char port[8];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+} dns_entry_t;
+
+struct uhttp {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+    unsigned sq_local_tail;           // entries filled but not yet published
+    unsigned to_submit;
+
+    slot_t *slots;
+    unsigned num_slots;
+    size_t buf_size;
+    char *buf_area;
+    size_t buf_area_len;
+    unsigned *done;                   // finished slots waiting for uhttp_wait
+    unsigned num_done;
+    idle_conn_t *pool;                // up to num_slots idle connections, oldest first
+    unsigned num_pooled;
+    uhttp_stats_t stats;
+
+    dns_entry_t *dns_cache;           // UHTTP_DNS_CACHE entries, replaced round robin
+    unsigned dns_cached, dns_next;
+    pthread_t resolvers[UHTTP_RESOLVERS];
+    unsigned num_resolvers;
+    int wake_fd;                      // eventfd the resolver bumps, -1 when closed
+    unsigned long long wake_val;      // target of the ring's read on wake_fd
+    pthread_mutex_t dns_lock;         // guards the two lists and dns_stop
+    pthread_cond_t dns_wanted;
+    unsigned *dns_queue;              // slots to resolve, a ring of num_slots
+    unsigned dns_head, dns_tail;
+    unsigned *dns_done;               // slots resolved, or not, since the last drain
+    unsigned dns_num_done;
+    int dns_stop;
+};
+
+static int ring_setup(uhttp_t *c, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    c->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (c->ring_fd < 0) return 0;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) return 0;  // needed for timed waits
+
+    c->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    c->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (c->cq_ring_len > c->sq_ring_len) c->sq_ring_len = c->cq_ring_len;
+        c->cq_ring_len = 0;
+    }
+    c->sq_ring = mmap(NULL, c->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      c->ring_fd, IORING_OFF_SQ_RING);
+    if (c->sq_ring == MAP_FAILED) {
+        c->sq_ring = NULL;
+        return 0;
+    }
+    if (c->cq_ring_len) {
+        c->cq_ring = mmap(NULL, c->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          c->ring_fd, IORING_OFF_CQ_RING);
+        if (c->cq_ring == MAP_FAILED) {
+            c->cq_ring = NULL;
+            return 0;
+        }
+    } else {
+        c->cq_ring = c->sq_ring;
+    }
+    c->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    c->sqes = mmap(NULL, c->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   c->ring_fd, IORING_OFF_SQES);
+    if (c->sqes == MAP_FAILED) {
+        c->sqes = NULL;
+        return 0;
+    }
+
+    char *sq = c->sq_ring, *cq = c->cq_ring;
+    c->sq_entries = p.sq_entries;
+    c->sq_head = (unsigned *)(sq + p.sq_off.head);
+    c->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    c->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    c->sq_array = (unsigned *)(sq + p.sq_off.array);
+    c->cq_head = (unsigned *)(cq + p.cq_off.head);
+    c->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    c->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    c->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    c->sq_local_tail = *c->sq_tail;
+    return 1;
+}
+
+static struct io_uring_sqe *get_sqe(uhttp_t *c) {
+    unsigned head = __atomic_load_n(c->sq_head, __ATOMIC_ACQUIRE);
+    if (c->sq_local_tail - head >= c->sq_entries) return NULL;
+    unsigned idx = c->sq_local_tail & *c->sq_mask;
+    c->sq_array[idx] = idx;
+    c->sq_local_tail++;
+    c->to_submit++;
+    struct io_uring_sqe *sqe = &c->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Publish queued entries and optionally wait for one completion
+static int ring_enter(uhttp_t *c, int timeout_ms) {
+    __atomic_store_n(c->sq_tail, c->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned flags = 0, min_complete = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms > 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        min_complete = 1;
+    }
+    for (;;) {
+        int ret = (int)syscall(__NR_io_uring_enter, c->ring_fd, c->to_submit, min_complete, flags,
+                               flags ? (void *)&arg : NULL, flags ? sizeof(arg) : 0);
+        if (ret >= 0) {
+            c->to_submit -= (unsigned)ret < c->to_submit ? (unsigned)ret : c->to_submit;
+            return 1;
+        }
+        if (errno == ETIME || errno == EINTR) return 1;
+        if (errno == EAGAIN || errno == EBUSY) continue;
+        return 0;
+    }
+}
+
+// Queue op for the slot with a linked timeout of ms
+static int queue_op(uhttp_t *c, unsigned i, struct io_uring_sqe *sqe, long ms) {
+    slot_t *s = &c->slots[i];
+    sqe->user_data = i;
+    sqe->flags |= IOSQE_IO_LINK;
+    struct io_uring_sqe *t = get_sqe(c);
+    if (!t) return 0;  // cannot happen with two entries reserved per slot
+    s->timeout.tv_sec = ms / 1000;
+    s->timeout.tv_nsec = (ms % 1000) * 1000000L;
+    t->opcode = IORING_OP_LINK_TIMEOUT;
+    t->fd = -1;
+    t->addr = (unsigned long long)(uintptr_t)&s->timeout;
+    t->len = 1;
+    t->user_data = UHTTP_TIMEOUT_TAG;
+    return 1;
+}
+
+static int queue_connect(uhttp_t *c, unsigned i) {
+    slot_t *s = &c->slots[i];
+    s->fd = socket(s->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s->fd < 0) return 0;
+    int one = 1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct io_uring_sqe *sqe = get_sqe(c);
+    if (!sqe) return 0;
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long long)(uintptr_t)&s->addr;
+    sqe->off = s->addr_len;
+    s->state = SLOT_CONNECT;
+    c->stats.connects++;
+    return queue_op(c, i, sqe, s->connect_ms);
+}
+
+static int queue_send(uhttp_t *c, unsigned i) {
+    slot_t *s = &c->slots[i];
+    struct io_uring_sqe *sqe = get_sqe(c);
+    if (!sqe) return 0;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long long)(uintptr_t)(s->req + s->req_sent);
+    sqe->len = (unsigned)(s->req_len - s->req_sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    s->state = SLOT_SEND;
+    return queue_op(c, i, sqe, s->timeout_ms);
+}
+
+// Receive straight into the slot's registered buffer
+static int queue_recv(uhttp_t *c, unsigned i) {
+    slot_t *s = &c->slots[i];
+    struct io_uring_sqe *sqe = get_sqe(c);
+    if (!sqe) return 0;
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long long)(uintptr_t)(s->buf + s->len);
+    sqe->len = (unsigned)(c->buf_size - s->len);
+    sqe->off = -1;  // sockets have no file position
+    sqe->buf_index = (unsigned short)i;
+    s->state = SLOT_RECV;
+    return queue_op(c, i, sqe, s->timeout_ms);
+}
+
+// Keep a read posted on the resolver's eventfd so a finished lookup ends
+// a wait on the ring
+static int queue_wake(uhttp_t *c) {
+    struct io_uring_sqe *sqe = get_sqe(c);
+    if (!sqe) return 0;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = c->wake_fd;
+    sqe->addr = (unsigned long long)(uintptr_t)&c->wake_val;
+    sqe->len = sizeof(c->wake_val);
+    sqe->off = -1;
+    sqe->user_data = UHTTP_WAKE_TAG;
+    return 1;
+}
+
+static void close_conn(slot_t *s) {
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+// Park a slot's connection for the next request to the same host
+static void pool_put(uhttp_t *c, slot_t *s) {
+    if (c->num_pooled == c->num_slots) {
+        close(c->pool[0].fd);  // full: drop the oldest
+        memmove(c->pool, c->pool + 1, (c->num_pooled - 1) * sizeof(idle_conn_t));
+        c->num_pooled--;
+    }
+    idle_conn_t *p = &c->pool[c->num_pooled++];
+    p->fd = s->fd;
+    strcpy(p->host, s->host);
+    strcpy(p->port, s->port);
+    s->fd = -1;
+}
+
+// Take the most recently parked connection to host:port, -1 if none
+static int pool_take(uhttp_t *c, const char *host, const char *port) {
+    for (unsigned k = c->num_pooled; k-- > 0;) {
+        if (strcmp(c->pool[k].host, host) == 0 && strcmp(c->pool[k].port, port) == 0) {
+            int fd = c->pool[k].fd;
+            memmove(c->pool + k, c->pool + k + 1, (c->num_pooled - k - 1) * sizeof(idle_conn_t));
+            c->num_pooled--;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+static void finish(uhttp_t *c, unsigned i, int outcome) {
+    slot_t *s = &c->slots[i];
+    s->outcome = outcome;
+    s->state = SLOT_DONE;
+    if (outcome == UHTTP_OK && s->keep_alive) {
+        pool_put(c, s);
+    } else {
+        close_conn(s);
+    }
+    if (outcome == UHTTP_FALLBACK) c->stats.fallbacks++;
+    c->done[c->num_done++] = i;
+}
+
+// Send the request on a fresh connection, e.g. after a kept alive one was
+// closed by the server while idle
+static void restart(uhttp_t *c, unsigned i) {
+    slot_t *s = &c->slots[i];
+    close_conn(s);
+    s->reused = 0;
+    s->req_sent = 0;
+    s->len = 0;
+    if (!queue_connect(c, i)) finish(c, i, UHTTP_ERROR);
+}
+
+// Parse the header block once it is complete; 0 while more bytes are needed
+static int parse_headers(uhttp_t *c, unsigned i) {
+    slot_t *s = &c->slots[i];
+    char *end = memmem(s->buf, s->len, "\r\n\r\n", 4);
+    if (!end) return 0;
+    s->hdr_len = end - s->buf + 4;
+    s->content_length = -1;
+
+    int minor = 0;
+    if (sscanf(s->buf, "HTTP/1.%d %ld", &minor, &s->status) != 2) {
+        finish(c, i, UHTTP_ERROR);
+        return 1;
+    }
+    s->keep_alive = minor >= 1;
+    int chunked = 0;
+
+    char *line = memchr(s->buf, '\n', s->hdr_len) + 1;
+    char *hdr_end = s->buf + s->hdr_len - 2;
+    while (line < hdr_end) {
+        char *nl = memchr(line, '\n', hdr_end - line);
+        if (!nl) nl = hdr_end;
+        char *colon = memchr(line, ':', nl - line);
+        if (colon) {
+            size_t name_len = colon - line;
+            char *value = colon + 1;
+            while (value < nl && (*value == ' ' || *value == '\t')) value++;
+            if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+                s->content_length = strtol(value, NULL, 10);
+            } else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+                chunked = strncasecmp(value, "identity", 8) != 0;
+            } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+                if (strncasecmp(value, "close", 5) == 0) s->keep_alive = 0;
+                else if (strncasecmp(value, "keep-alive", 10) == 0) s->keep_alive = 1;
+            }
+        }
+        line = nl + 1;
+    }
+
+    if (s->status == 204 || s->status == 304) {
+        s->content_length = 0;
+    }
+    if (s->content_length < 0) {
+        s->keep_alive = 0;  // body runs to EOF
+    }
+    if ((s->status >= 300 && s->status < 400 && s->status != 304) || s->status < 200 || chunked ||
+        (s->content_length >= 0 && s->hdr_len + (size_t)s->content_length > c->buf_size)) {
+        finish(c, i, UHTTP_FALLBACK);
+        return 1;
+    }
+    return 1;
+}
+
+static void handle_cqe(uhttp_t *c, unsigned i, int res) {
+    slot_t *s = &c->slots[i];
+    switch (s->state) {
+    case SLOT_CONNECT:
+        if (res < 0) {
+            finish(c, i, UHTTP_ERROR);
+        } else if (!queue_send(c, i)) {
+            finish(c, i, UHTTP_ERROR);
+        }
+        break;
+    case SLOT_SEND:
+        if (res <= 0) {
+            if (s->reused) restart(c, i);
+            else finish(c, i, UHTTP_ERROR);
+            break;
+        }
+        s->req_sent += res;
+        if (!(s->req_sent < s->req_len ? queue_send(c, i) : queue_recv(c, i))) {
+            finish(c, i, UHTTP_ERROR);
+        }
+        break;
+    case SLOT_RECV:
+        if (res <= 0) {
+            if (s->len == 0 && s->reused) {
+                restart(c, i);  // server dropped the idle connection
+            } else if (res == 0 && s->hdr_len && s->content_length < 0) {
+                s->buf[s->len] = '\0';
+                finish(c, i, UHTTP_OK);
+            } else {
+                finish(c, i, UHTTP_ERROR);
+            }
+            break;
+        }
+        s->len += res;
+        if (!s->hdr_len && !parse_headers(c, i) && s->len == c->buf_size) {
+            finish(c, i, UHTTP_FALLBACK);  // header block larger than the buffer
+            break;
+        }
+        if (s->state == SLOT_DONE) break;
+        if (s->hdr_len && s->content_length >= 0 &&
+            s->len >= s->hdr_len + (size_t)s->content_length) {
+            s->len = s->hdr_len + s->content_length;
+            s->buf[s->len] = '\0';
+            finish(c, i, UHTTP_OK);
+        } else if (s->len == c->buf_size) {
+            finish(c, i, UHTTP_FALLBACK);  // body runs past the buffer
+        } else if (!queue_recv(c, i)) {
+            finish(c, i, UHTTP_ERROR);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void reap(uhttp_t *c) {
+    unsigned head = *c->cq_head;
+    unsigned tail = __atomic_load_n(c->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &c->cqes[head & *c->cq_mask];
+        if (cqe->user_data == UHTTP_WAKE_TAG) {
+            queue_wake(c);  // the done list is drained after every reap
+        } else if (cqe->user_data != UHTTP_TIMEOUT_TAG) {
+            handle_cqe(c, (unsigned)cqe->user_data, cqe->res);
+        }
+        head++;
+    }
+    __atomic_store_n(c->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static const dns_entry_t *dns_lookup(const uhttp_t *c, const char *host, const char *port) {
+    for (unsigned k = 0; k < c->dns_cached; k++) {
+        if (strcmp(c->dns_cache[k].host, host) == 0 && strcmp(c->dns_cache[k].port, port) == 0) {
+            return &c->dns_cache[k];
+        }
+    }
+    return NULL;
+}
+
+static void dns_remember(uhttp_t *c, const slot_t *s) {
+    dns_entry_t *e = &c->dns_cache[c->dns_next];
+    c->dns_next = (c->dns_next + 1) % UHTTP_DNS_CACHE;
+    if (c->dns_cached < UHTTP_DNS_CACHE) c->dns_cached++;
+    strcpy(e->host, s->host);
+    strcpy(e->port, s->port);
+    e->addr = s->addr;
+    e->addr_len = s->addr_len;
+}
+
+// Resolve the slot's host and port into its address, addr_len 0 on failure
+static void resolve(slot_t *s, int numeric_only) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = numeric_only ? AI_NUMERICHOST : 0;
+    s->addr_len = 0;
+    if (getaddrinfo(s->host, s->port, &hints, &res) == 0 && res) {
+        memcpy(&s->addr, res->ai_addr, res->ai_addrlen);
+        s->addr_len = res->ai_addrlen;
+    }
+    if (res) freeaddrinfo(res);
+}
+
+// Resolver thread: look up queued slots' hosts
+static void *resolver_main(void *arg) {
+    uhttp_t *c = arg;
+    pthread_mutex_lock(&c->dns_lock);
+    for (;;) {
+        while (c->dns_head == c->dns_tail && !c->dns_stop) {
+            pthread_cond_wait(&c->dns_wanted, &c->dns_lock);
+        }
+        if (c->dns_stop) break;
+        unsigned i = c->dns_queue[c->dns_head++ % c->num_slots];
+        slot_t *s = &c->slots[i];
+        pthread_mutex_unlock(&c->dns_lock);
+        resolve(s, 0);
+        pthread_mutex_lock(&c->dns_lock);
+        c->dns_done[c->dns_num_done++] = i;
+        unsigned long long one = 1;
+        ssize_t n = write(c->wake_fd, &one, sizeof(one));
+        (void)n;  // fails only if the counter would overflow, i.e. a wake is pending
+    }
+    pthread_mutex_unlock(&c->dns_lock);
+    return NULL;
+}
+
+// Start the request in slot i once its address is known
+static void start_request(uhttp_t *c, unsigned i) {
+    slot_t *s = &c->slots[i];
+    s->fd = pool_take(c, s->host, s->port);
+    s->reused = s->fd >= 0;
+    if (s->reused) c->stats.reused++;
+    if (!(s->reused ? queue_send(c, i) : queue_connect(c, i))) {
+        close_conn(s);
+        finish(c, i, UHTTP_ERROR);
+    }
+}
+
+// Pick up the slots the resolver is done with. A host that does not
+// resolve goes back as a fallback, so the caller's client reports it.
+static void dns_drain(uhttp_t *c) {
+    pthread_mutex_lock(&c->dns_lock);
+    for (unsigned k = 0; k < c->dns_num_done; k++) {
+        unsigned i = c->dns_done[k];
+        if (c->slots[i].addr_len == 0) {
+            finish(c, i, UHTTP_FALLBACK);
+            continue;
+        }
+        dns_remember(c, &c->slots[i]);
+        start_request(c, i);
+    }
+    c->dns_num_done = 0;
+    pthread_mutex_unlock(&c->dns_lock);
+}
+
+uhttp_t *uhttp_create(unsigned slots, size_t buf_size) {
+    if (slots == 0 || buf_size < 1024) return NULL;
+    uhttp_t *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->ring_fd = -1;
+    c->num_slots = slots;
+    c->buf_size = buf_size;
+    c->slots = calloc(slots, sizeof(slot_t));
+    c->done = calloc(slots, sizeof(unsigned));
+    c->pool = calloc(slots, sizeof(idle_conn_t));
+    c->dns_cache = calloc(UHTTP_DNS_CACHE, sizeof(dns_entry_t));
+    c->dns_queue = calloc(slots, sizeof(unsigned));
+    c->dns_done = calloc(slots, sizeof(unsigned));
+    c->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pthread_mutex_init(&c->dns_lock, NULL);
+    pthread_cond_init(&c->dns_wanted, NULL);
+    struct iovec *iov = calloc(slots, sizeof(struct iovec));
+
+    // One mapping for all receive buffers, one byte spare per slot for the NUL
+    size_t stride = (buf_size + 1 + 63) & ~(size_t)63;
+    c->buf_area_len = stride * slots;
+    c->buf_area = mmap(NULL, c->buf_area_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c->buf_area == MAP_FAILED) c->buf_area = NULL;
+
+    if (!c->slots || !c->done || !c->pool || !c->dns_cache || !c->dns_queue || !c->dns_done ||
+        c->wake_fd < 0 || !iov || !c->buf_area || !ring_setup(c, slots * 2 + 1)) {
+        free(iov);
+        uhttp_destroy(c);
+        return NULL;
+    }
+    for (unsigned i = 0; i < slots; i++) {
+        c->slots[i].fd = -1;
+        c->slots[i].buf = c->buf_area + i * stride;
+        iov[i].iov_base = c->slots[i].buf;
+        iov[i].iov_len = buf_size;
+    }
+    int ret = (int)syscall(__NR_io_uring_register, c->ring_fd, IORING_REGISTER_BUFFERS, iov, slots);
+    free(iov);
+    if (ret < 0 || !queue_wake(c)) {
+        uhttp_destroy(c);
+        return NULL;
+    }
+    while (c->num_resolvers < UHTTP_RESOLVERS && c->num_resolvers < slots &&
+           pthread_create(&c->resolvers[c->num_resolvers], NULL, resolver_main, c) == 0) {
+        c->num_resolvers++;
+    }
+    if (c->num_resolvers == 0) {
+        uhttp_destroy(c);
+        return NULL;
+    }
+    return c;
+}
+
+void uhttp_destroy(uhttp_t *c) {
+    if (!c) return;
+    if (c->num_resolvers > 0) {
+        // Lookups in progress finish first; queued ones are dropped
+        pthread_mutex_lock(&c->dns_lock);
+        c->dns_stop = 1;
+        pthread_cond_broadcast(&c->dns_wanted);
+        pthread_mutex_unlock(&c->dns_lock);
+        for (unsigned k = 0; k < c->num_resolvers; k++) {
+            pthread_join(c->resolvers[k], NULL);
+        }
+    }
+    if (c->slots) {
+        for (unsigned i = 0; i < c->num_slots; i++) close_conn(&c->slots[i]);
+    }
+    for (unsigned k = 0; k < c->num_pooled; k++) close(c->pool[k].fd);
+    if (c->ring_fd >= 0) close(c->ring_fd);  // cancels anything still in flight
+    if (c->sqes) munmap(c->sqes, c->sqes_len);
+    if (c->cq_ring && c->cq_ring != c->sq_ring) munmap(c->cq_ring, c->cq_ring_len);
+    if (c->sq_ring) munmap(c->sq_ring, c->sq_ring_len);
+    if (c->buf_area) munmap(c->buf_area, c->buf_area_len);
+    if (c->wake_fd >= 0) close(c->wake_fd);
+    pthread_cond_destroy(&c->dns_wanted);
+    pthread_mutex_destroy(&c->dns_lock);
+    free(c->slots);
+    free(c->done);
+    free(c->pool);
+    free(c->dns_cache);
+    free(c->dns_queue);
+    free(c->dns_done);
+    free(c);
+}
+
+int uhttp_supports(const char *url) {
+    return url && strncasecmp(url, "http://", 7) == 0;
+}
+
+// Split an http:// URL into host, port and request target
+static int split_url(const char *url, char *host, char *port, const char **target) {
+    const char *h = url + 7;
+    size_t host_len = strcspn(h, ":/?#");
+    if (host_len == 0 || host_len >= UHTTP_HOST_MAX) return 0;
+    memcpy(host, h, host_len);
+    host[host_len] = '\0';
+    const char *p = h + host_len;
+    if (*p == ':') {
+        size_t port_len = strcspn(p + 1, "/?#");
+        if (port_len == 0 || port_len >= 8) return 0;
+        memcpy(port, p + 1, port_len);
+        port[port_len] = '\0';
+        p += 1 + port_len;
+    } else {
+        strcpy(port, "80");
+    }
+    *target = p;
+    return 1;
+}
+
+int uhttp_submit(uhttp_t *c, const char *url, const char *extra_headers, long connect_ms, long timeout_ms,
+                 void *user) {
+    if (!uhttp_supports(url)) return 0;
+    unsigned i;
+    for (i = 0; i < c->num_slots && c->slots[i].state != SLOT_IDLE; i++);
+    if (i == c->num_slots) return 0;
+    slot_t *s = &c->slots[i];
+
+    char host[UHTTP_HOST_MAX], port[8];
+    const char *target;
+    if (!split_url(url, host, port, &target)) return 0;
+    size_t target_len = strcspn(target, "#");
+
+    int n = snprintf(s->req, sizeof(s->req),
+                     "GET %s%.*s HTTP/1.1\r\nHost: %s%s%s\r\nUser-Agent: findpng2/1.0\r\nAccept: */*\r\n%s\r\n",
+                     *target == '/' ? "" : "/", (int)target_len, target, host,
+                     strcmp(port, "80") ? ":" : "", strcmp(port, "80") ? port : "",
+                     extra_headers ? extra_headers : "");
+    if (n < 0 || (size_t)n >= sizeof(s->req)) return 0;
+    s->req_len = n;
+    s->req_sent = 0;
+
+    s->user = user;
+    s->connect_ms = connect_ms > 0 ? connect_ms : timeout_ms;
+    s->timeout_ms = timeout_ms;
+    s->len = 0;
+    s->hdr_len = 0;
+    s->status = 0;
+    s->keep_alive = 0;
+    c->stats.requests++;
+
+    // Look the host up only when neither the slot nor the cache knows it
+    int same_host = s->addr_len && strcmp(s->host, host) == 0 && strcmp(s->port, port) == 0;
+    if (!same_host) {
+        strcpy(s->host, host);
+        strcpy(s->port, port);
+        const dns_entry_t *e = dns_lookup(c, host, port);
+        if (e) {
+            s->addr = e->addr;
+            s->addr_len = e->addr_len;
+        } else {
+            resolve(s, 1);  // an IP address needs no lookup
+        }
+        if (s->addr_len == 0) {
+            s->state = SLOT_RESOLVE;
+            pthread_mutex_lock(&c->dns_lock);
+            c->dns_queue[c->dns_tail++ % c->num_slots] = i;
+            pthread_cond_signal(&c->dns_wanted);
+            pthread_mutex_unlock(&c->dns_lock);
+            return 1;
+        }
+    }
+    start_request(c, i);
+    return 1;
+}
+
+int uhttp_wait(uhttp_t *c, uhttp_result_t *out, int timeout_ms) {
+    if (c->num_done == 0) {
+        if (!ring_enter(c, timeout_ms)) return -1;
+        reap(c);
+        dns_drain(c);
+        if (c->to_submit && !ring_enter(c, 0)) return -1;  // ops queued while reaping
+    }
+    if (c->num_done == 0) return 0;
+
+    unsigned i = c->done[--c->num_done];
+    slot_t *s = &c->slots[i];
+    memset(out, 0, sizeof(*out));
+    out->outcome = s->outcome;
+    out->status = s->status;
+    out->user = s->user;
+    out->slot = i;
+    if (s->outcome == UHTTP_OK) {
+        out->headers = s->buf;
+        out->hdr_len = s->hdr_len;
+        out->body = s->buf + s->hdr_len;
+        out->body_len = s->len - s->hdr_len;
+    }
+    return 1;
+}
+
+void uhttp_recycle(uhttp_t *c, unsigned slot) {
+    if (slot < c->num_slots && c->slots[slot].state == SLOT_DONE) {
+        c->slots[slot].state = SLOT_IDLE;
+        c->slots[slot].user = NULL;
+    }
+}
+
+void uhttp_get_stats(const uhttp_t *c, uhttp_stats_t *out) {
+    *out = c->stats;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file: url_filter.c
+ * @brief: blocked Bloom filter with an optional file backed exact tier, see url_filter.h
+ *
+ * Sizing: a standard Bloom filter needs -ln(p) / ln(2)^2 bits per key for a
+ * false positive rate p with k = bits * ln(2) hashes. Confining the bits to
+ * one block makes the filter less uniform, since some blocks get more than
+ * their share of URLs, so the bits per key are raised until the expected rate
+ * of the blocked layout (Putze et al., a Poisson mix over block loads) meets
+ * p. The exact tier has EXACT_SHARDS open addressing tables of
+ * fingerprints in one mapping, each sized for twice its share of the
+ * expected URLs and locked on its own.
+ */
+
+#define _GNU_SOURCE  // MAP_* and madvise
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "url_filter.h"
+#include "fingerprint.h"
+
+#define BLOCK_BITS 512             // one cache line
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+#define MAX_HASHES 16
+#define EXACT_SHARD_BITS 6
+#define EXACT_SHARDS (1u << EXACT_SHARD_BITS)
+#define EXACT_MIN_SLOTS 1024       // per shard
+#define BLOOM_LOCKS 1024           // striped over the blocks, for adds
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t *slots;               // inside the mapping
+    size_t count;
+} exact_shard_t;
+
+struct url_filter {
+    atomic_ullong *words;
+    size_t num_blocks;
+    unsigned hashes;
+    atomic_flag locks[BLOOM_LOCKS];
+
+    FILE *table_fp;                // NULL without an exact tier
+    uint64_t *table;
+    size_t table_bytes;
+    size_t shard_capacity;         // slots per shard, a power of two
+    exact_shard_t shards[EXACT_SHARDS];
+
+    atomic_ullong added;
+    atomic_ullong false_positives;
+    atomic_ullong overflowed;
+    atomic_int overflow_warned;
+};
+
+static uint64_t url_hash(const char *url) {
+    return fp_hash64(url, strlen(url), 0);
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Block of a hash and its bit positions in it. The positions are drawn
+// independently, 9 bits at a time from a remixed stream; arithmetic
+// progressions of positions correlate and cost a measurable false positive
+// rate.
+static atomic_ullong *hash_bits(const url_filter_t *f, uint64_t h, unsigned *bits) {
+    size_t block = (size_t)(((h >> 32) * (uint64_t)f->num_blocks) >> 32);
+    uint64_t seed = h;
+    uint64_t x = mix64(seed);
+    unsigned left = 64;
+    for (unsigned i = 0; i < f->hashes; i++) {
+        if (left < 9) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            x = mix64(seed);
+            left = 64;
+        }
+        bits[i] = (unsigned)(x & (BLOCK_BITS - 1));
+        x >>= 9;
+        left -= 9;
+    }
+    return f->words + block * BLOCK_WORDS;
+}
+
+// Set the URL's bits, 1 if all of them were set already. The bits span
+// several words, so two threads adding the same URL could each find a
+// different word short of its bits and both call it new; the block's stripe
+// lock makes the test and the set one step. Lookups take no lock.
+static int bloom_test_and_set(url_filter_t *f, uint64_t h) {
+    unsigned bits[MAX_HASHES];
+    atomic_ullong *block = hash_bits(f, h, bits);
+    unsigned long long masks[BLOCK_WORDS] = {0};
+    for (unsigned i = 0; i < f->hashes; i++) {
+        masks[bits[i] / 64] |= 1ULL << (bits[i] % 64);
+    }
+    atomic_flag *lock = &f->locks[(size_t)(block - f->words) / BLOCK_WORDS % BLOOM_LOCKS];
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire));
+    int present = 1;
+    for (unsigned w = 0; w < BLOCK_WORDS; w++) {
+        if (masks[w] &&
+            (atomic_fetch_or_explicit(&block[w], masks[w], memory_order_relaxed) & masks[w]) != masks[w]) {
+            present = 0;
+        }
+    }
+    atomic_flag_clear_explicit(lock, memory_order_release);
+    return present;
+}
+
+static int bloom_test(const url_filter_t *f, uint64_t h) {
+    unsigned bits[MAX_HASHES];
+    atomic_ullong *block = hash_bits(f, h, bits);
+    for (unsigned i = 0; i < f->hashes; i++) {
+        unsigned bit = bits[i];
+        if (!(atomic_load_explicit(&block[bit / 64], memory_order_relaxed) & (1ULL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Look up fp in the exact tier and record it if absent: 1 if it was new,
+// 0 if present, -1 if it was absent but its shard, past three quarters full,
+// could not record it.
+static int exact_insert(url_filter_t *f, uint64_t fp, int add) {
+    if (fp == 0) fp = 1;  // 0 marks an empty slot
+    exact_shard_t *s = &f->shards[fp >> (64 - EXACT_SHARD_BITS)];
+    size_t mask = f->shard_capacity - 1;
+    pthread_mutex_lock(&s->lock);
+    size_t i = fp & mask;
+    while (s->slots[i]) {
+        if (s->slots[i] == fp) {
+            pthread_mutex_unlock(&s->lock);
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    if (!add) {
+        pthread_mutex_unlock(&s->lock);
+        return 1;
+    }
+    if ((s->count + 1) * 4 > f->shard_capacity * 3) {
+        pthread_mutex_unlock(&s->lock);
+        atomic_fetch_add(&f->overflowed, 1);
+        if (!atomic_exchange(&f->overflow_warned, 1)) {
+            fprintf(stderr, "url_filter: exact tier full, falling back to the Bloom filter, "
+                    "raise --expected-urls\n");
+        }
+        return -1;
+    }
+    s->slots[i] = fp;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+    return 1;
+}
+
+static int exact_create(url_filter_t *f, unsigned long long expected) {
+    size_t want = (size_t)(expected * 2 / EXACT_SHARDS);
+    size_t capacity = EXACT_MIN_SLOTS;
+    while (capacity < want) capacity *= 2;
+    f->shard_capacity = capacity;
+    f->table_bytes = EXACT_SHARDS * capacity * sizeof(uint64_t);
+
+    f->table_fp = tmpfile();
+    if (!f->table_fp) {
+        perror("url_filter: tmpfile");
+        return 0;
+    }
+    int fd = fileno(f->table_fp);
+    if (ftruncate(fd, (off_t)f->table_bytes) != 0) {  // sparse, blocks appear as slots fill
+        perror("url_filter: ftruncate");
+        return 0;
+    }
+    void *map = mmap(NULL, f->table_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("url_filter: mmap");
+        return 0;
+    }
+    madvise(map, f->table_bytes, MADV_RANDOM);
+    f->table = map;
+    for (unsigned k = 0; k < EXACT_SHARDS; k++) {
+        pthread_mutex_init(&f->shards[k].lock, NULL);
+        f->shards[k].slots = f->table + k * capacity;
+        f->shards[k].count = 0;
+    }
+    return 1;
+}
+
+// Expected false positive rate of a blocked filter with the given density
+static double blocked_fp_rate(double bits_per_url, unsigned hashes) {
+    double lambda = BLOCK_BITS / bits_per_url;  // mean URLs per block
+    double term = exp(-lambda);                 // Poisson probability of j URLs
+    double rate = 0;
+    for (unsigned j = 0; j < 4 * lambda + 64; j++) {
+        if (j > 0) term *= lambda / j;
+        double fill = 1 - pow(1 - 1.0 / BLOCK_BITS, (double)hashes * j);
+        rate += term * pow(fill, hashes);
+    }
+    return rate;
+}
+
+static unsigned hashes_for(double bits_per_url) {
+    long k = lround(bits_per_url * M_LN2);
+    return k < 1 ? 1 : k > MAX_HASHES ? MAX_HASHES : (unsigned)k;
+}
+
+url_filter_t *url_filter_create(unsigned long long expected, double fp_rate, int exact_tier) {
+    if (expected == 0 || fp_rate <= 0 || fp_rate >= 1) return NULL;
+    url_filter_t *f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+
+    double bits_per_url = -log(fp_rate) / (M_LN2 * M_LN2);
+    while (bits_per_url < 64 && blocked_fp_rate(bits_per_url, hashes_for(bits_per_url)) > fp_rate) {
+        bits_per_url += 0.25;
+    }
+    f->hashes = hashes_for(bits_per_url);
+    double bits = bits_per_url * (double)expected;
+    f->num_blocks = (size_t)(bits / BLOCK_BITS) + 1;
+    void *words = NULL;
+    if (posix_memalign(&words, 64, f->num_blocks * BLOCK_WORDS * sizeof(atomic_ullong)) != 0) {
+        free(f);
+        return NULL;
+    }
+    memset(words, 0, f->num_blocks * BLOCK_WORDS * sizeof(atomic_ullong));
+    f->words = words;
+    for (unsigned k = 0; k < BLOOM_LOCKS; k++) {
+        atomic_flag_clear(&f->locks[k]);
+    }
+
+    if (exact_tier && !exact_create(f, expected)) {
+        url_filter_destroy(f);
+        return NULL;
+    }
+    return f;
+}
+
+void url_filter_destroy(url_filter_t *f) {
+    if (!f) return;
+    if (f->table) {
+        munmap(f->table, f->table_bytes);
+        for (unsigned k = 0; k < EXACT_SHARDS; k++) {
+            pthread_mutex_destroy(&f->shards[k].lock);
+        }
+    }
+    if (f->table_fp) fclose(f->table_fp);
+    free(f->words);
+    free(f);
+}
+
+int url_filter_add(url_filter_t *f, const char *url) {
+    uint64_t h = url_hash(url);
+    int maybe = bloom_test_and_set(f, h);
+    int added;
+    if (!f->table_fp) {
+        added = !maybe;
+    } else {
+        added = exact_insert(f, h, 1);
+        if (added < 0) {
+            // Unrecorded, calling it new would fetch it again on every
+            // visit; a link cycle would never end
+            added = !maybe;
+        } else if (maybe && added) {
+            atomic_fetch_add(&f->false_positives, 1);
+        }
+    }
+    if (added) atomic_fetch_add(&f->added, 1);
+    return added;
+}
+
+int url_filter_contains(url_filter_t *f, const char *url) {
+    uint64_t h = url_hash(url);
+    if (!bloom_test(f, h)) return 0;
+    // Only a "maybe" costs a look at the exact tier
+    return f->table_fp ? !exact_insert(f, h, 0) : 1;
+}
+
+void url_filter_get_stats(const url_filter_t *f, url_filter_stats_t *out) {
+    out->added = atomic_load(&f->added);
+    out->false_positives = atomic_load(&f->false_positives);
+    out->overflowed = atomic_load(&f->overflowed);
+    out->filter_bytes = f->num_blocks * BLOCK_WORDS * sizeof(atomic_ullong);
+    out->table_bytes = f->table_fp ? f->table_bytes : 0;
+    out->hashes = f->hashes;
+}
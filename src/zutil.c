@@ -10,131 +10,289 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include "zutil.h"
 
+#define DICT_SIZE 32768  /* deflate window, the most dictionary mem_def_block primes */
+
+/* run deflate over all of source into dest, ending with flush once the last
+   input is in. avail_in and avail_out are 32 bits, so both buffers are
+   handed to zlib a piece at a time. dest_len is the capacity of dest on the
+   way in and the length written on the way out */
+static int def_run(z_stream *strm, U8 *dest, U64 *dest_len, const U8 *source, U64 source_len, int flush)
+{
+    U64 in_left = source_len;
+    U64 out_left = *dest_len;
+    int ret;
+
+    strm->next_in = (U8 *) source;
+    strm->avail_in = 0;
+    strm->next_out = dest;
+    strm->avail_out = 0;
+    for (;;) {
+        if (strm->avail_in == 0 && in_left > 0) {
+            strm->avail_in = in_left > UINT_MAX ? UINT_MAX : (uInt) in_left;
+            in_left -= strm->avail_in;
+        }
+        if (strm->avail_out == 0 && out_left > 0) {
+            strm->avail_out = out_left > UINT_MAX ? UINT_MAX : (uInt) out_left;
+            out_left -= strm->avail_out;
+        }
+        int last = in_left == 0;
+        ret = deflate(strm, last ? flush : Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            ret = Z_OK;
+            break;
+        }
+        if (ret != Z_OK) {
+            break;      /* Z_BUF_ERROR: dest is full */
+        }
+        if (flush != Z_FINISH && last && strm->avail_in == 0 && strm->avail_out > 0) {
+            break;      /* flushed to a byte boundary */
+        }
+    }
+    *dest_len -= out_left + strm->avail_out;
+    return ret;
+}
+
+/* inflate one stream from source into dest, dest_len as for def_run */
+static int inf_run(z_stream *strm, U8 *dest, U64 *dest_len, const U8 *source, U64 source_len)
+{
+    U64 in_left = source_len;
+    U64 out_left = *dest_len;
+    int ret;
+
+    strm->next_in = (U8 *) source;
+    strm->avail_in = 0;
+    strm->next_out = dest;
+    strm->avail_out = 0;
+    for (;;) {
+        if (strm->avail_in == 0 && in_left > 0) {
+            strm->avail_in = in_left > UINT_MAX ? UINT_MAX : (uInt) in_left;
+            in_left -= strm->avail_in;
+        }
+        if (strm->avail_out == 0 && out_left > 0) {
+            strm->avail_out = out_left > UINT_MAX ? UINT_MAX : (uInt) out_left;
+            out_left -= strm->avail_out;
+        }
+        ret = inflate(strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            ret = Z_OK;
+            break;
+        }
+        if (ret == Z_NEED_DICT) {
+            ret = Z_DATA_ERROR;
+            break;
+        }
+        if (ret == Z_BUF_ERROR) {
+            /* out of room, or the input ended before the stream did */
+            ret = strm->avail_out == 0 && out_left == 0 ? Z_BUF_ERROR : Z_DATA_ERROR;
+            break;
+        }
+        if (ret != Z_OK) {
+            break;
+        }
+    }
+    *dest_len -= out_left + strm->avail_out;
+    return ret;
+}
+
+/**
+ * @brief: set up a deflate context that mem_def_ctx can use again and again
+ * @param: ctx mem_ctx_t* the context, freed by mem_ctx_end
+ * @param: level int compression level as for mem_def
+ * @param: raw int non-zero for raw deflate data without the zlib header
+ *         and trailer, as mem_def_block needs
+ * @return =0  on success
+ *         <>0 on error
+ */
+int mem_def_init(mem_ctx_t *ctx, int level, int raw)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->deflate = 1;
+    return deflateInit2(&ctx->strm, level, Z_DEFLATED, raw ? -MAX_WBITS : MAX_WBITS,
+                        8, Z_DEFAULT_STRATEGY);
+}
+
+/**
+ * @brief: set up an inflate context that mem_inf_ctx can use again and again
+ * @param: ctx mem_ctx_t* the context, freed by mem_ctx_end
+ * @param: raw int non-zero for raw deflate data, zero for zlib streams
+ * @return =0  on success
+ *         <>0 on error
+ */
+int mem_inf_init(mem_ctx_t *ctx, int raw)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->deflate = 0;
+    return inflateInit2(&ctx->strm, raw ? -MAX_WBITS : MAX_WBITS);
+}
+
+/**
+ * @brief: free the zlib state of a context from mem_def_init or mem_inf_init
+ * @param: ctx mem_ctx_t* the context, which must not be copied once set up
+ */
+void mem_ctx_end(mem_ctx_t *ctx)
+{
+    if (ctx->deflate) {
+        (void) deflateEnd(&ctx->strm);
+    } else {
+        (void) inflateEnd(&ctx->strm);
+    }
+}
+
+/**
+ * @brief: the most output deflating source_len bytes can take, at any level,
+ *         as a zlib stream or as a raw block ended by a sync flush
+ * @param: source_len U64 length of the data to be deflated
+ * @return size for dest that mem_def, mem_def_ctx and mem_def_block never
+ *         run out of
+ */
+U64 mem_def_bound(U64 source_len)
+{
+    /* the sync flush adds at most an empty stored block */
+    return compressBound(source_len) + 16;
+}
+
+/**
+ * @brief: deflate source to one complete zlib (or raw) stream in dest,
+ *         reusing the state in ctx instead of setting up a new one
+ * @param: ctx mem_ctx_t* a deflate context from mem_def_init
+ * @param: dest U8* output buffer, deflate writes straight into it
+ * @param: dest_len U64* in: capacity of dest, out: length of deflated data
+ * @param: source const U8* data to be deflated, source_len its length
+ * @return =0  on success
+ *         Z_BUF_ERROR when dest is too small, see mem_def_bound
+ *         <>0 on other errors
+ */
+int mem_def_ctx(mem_ctx_t *ctx, U8 *dest, U64 *dest_len, const U8 *source, U64 source_len)
+{
+    int ret = deflateReset(&ctx->strm);
+    if (ret != Z_OK) {
+        return ret;
+    }
+    return def_run(&ctx->strm, dest, dest_len, source, source_len, Z_FINISH);
+}
+
+/**
+ * @brief: inflate one stream from source straight into dest, reusing the
+ *         state in ctx instead of setting up a new one
+ * @param: ctx mem_ctx_t* an inflate context from mem_inf_init
+ * @param: dest U8* output buffer
+ * @param: dest_len U64* in: capacity of dest, out: length of inflated data
+ * @param: source const U8* deflated data, source_len its length
+ * @return =0  on success
+ *         Z_BUF_ERROR when dest is too small
+ *         Z_DATA_ERROR when the data is corrupt or cut short
+ */
+int mem_inf_ctx(mem_ctx_t *ctx, U8 *dest, U64 *dest_len, const U8 *source, U64 source_len)
+{
+    int ret = inflateReset(&ctx->strm);
+    if (ret != Z_OK) {
+        return ret;
+    }
+    return inf_run(&ctx->strm, dest, dest_len, source, source_len);
+}
+
 /**
  * @brief: deflate in memory data from source to dest.
  *         The memory areas must not overlap.
- * @param: dest U8* output buffer, caller supplies, should be big enough
- *         to hold the deflated data
- * @param: dest_len, U64* output parameter, points to length of deflated data
+ * @param: dest U8* output buffer, caller supplies, mem_def_bound(source_len)
+ *         bytes always hold the deflated data
+ * @param: dest_len, U64* in: capacity of dest, out: length of deflated data
  * @param: source U8* source buffer, contains data to be deflated
  * @param: source_len U64 length of source data
  * @param: level int compression levels (https://www.zlib.net/manual.html)
  *    Z_NO_COMPRESSION, Z_BEST_SPEED, Z_BEST_COMPRESSION, Z_DEFAULT_COMPRESSION
- * @return =0  on success 
- *         <>0 on error
+ * @return =0  on success
+ *         <>0 on error, Z_BUF_ERROR when dest is too small
  * NOTE: 1. the compressed data length may be longer than the input data length,
  *          especially when the input data size is very small.
+ *       2. each call sets up and frees a zlib stream, mem_def_ctx reuses one
  */
 int mem_def(U8 *dest, U64 *dest_len, U8 *source,  U64 source_len, int level)
 {
-    z_stream strm;    /* pass info. to and from zlib routines   */
-    U8 out[CHUNK];    /* output buffer for deflate()            */
-    int ret = 0;      /* zlib return code                       */
-    int have = 0;     /* amount of data returned from deflate() */
-    int def_len = 0;  /* accumulated deflated data length       */
-    U8 *p_dest = dest;/* first empty slot in dest buffer        */
-
-    
-    strm.zalloc = Z_NULL;
-    strm.zfree  = Z_NULL;
-    strm.opaque = Z_NULL;
-
-    ret = deflateInit(&strm, level);
+    mem_ctx_t ctx;
+    int ret = mem_def_init(&ctx, level, 0);
     if (ret != Z_OK) {
         return ret;
     }
+    ret = def_run(&ctx.strm, dest, dest_len, source, source_len, Z_FINISH);
+    mem_ctx_end(&ctx);
+    return ret;
+}
 
-    /* set input data stream */
-    strm.avail_in = source_len;
-    strm.next_in = source;
-
-    /* call deflate repetitively since the out buffer size is fixed
-       and the deflated output data length is not known ahead of time */
-
-    do {
-        strm.avail_out = CHUNK;
-        strm.next_out = out;
-        ret = deflate(&strm, Z_FINISH); /* source contains the whole data */
-        assert(ret != Z_STREAM_ERROR);
-        have = CHUNK - strm.avail_out; 
-        memcpy(p_dest, out, have);
-        p_dest += have;  /* advance to the next free byte to write */
-        def_len += have; /* increment deflated data length         */
-    } while (strm.avail_out == 0);
-
-    assert(strm.avail_in == 0);   /* all input will be used  */
-    assert(ret == Z_STREAM_END);  /* stream will be complete */
-
-    /* clean up and return */
-    (void) deflateEnd(&strm);
-    *dest_len = def_len;
-    return Z_OK;
+/**
+ * @brief: deflate one block of input that is cut into pieces, to raw deflate
+ *         data that can be joined to the blocks before and after it in order
+ * @param: ctx mem_ctx_t* a raw deflate context from mem_def_init, which sets
+ *         the level; it is reset for each block
+ * @param: dest U8* output buffer, mem_def_bound(source_len) always suffices
+ * @param: dest_len U64* in: capacity of dest, out: length of the deflated data
+ * @param: dict const U8* the input just before the block, to prime the window
+ * @param: dict_len U64 bytes of dict, only the last 32K are used
+ * @param: source const U8* the block, source_len its length
+ * @param: last int non-zero for the final block, which ends the deflate
+ *         stream; other blocks end on a byte boundary (sync flush)
+ * @return =0  on success
+ *         <>0 on error
+ */
+int mem_def_block(mem_ctx_t *ctx, U8 *dest, U64 *dest_len, const U8 *dict, U64 dict_len,
+                  const U8 *source, U64 source_len, int last)
+{
+    int ret = deflateReset(&ctx->strm);
+    if (ret != Z_OK) {
+        return ret;
+    }
+    if (dict_len > 0) {
+        if (dict_len > DICT_SIZE) {
+            dict += dict_len - DICT_SIZE;
+            dict_len = DICT_SIZE;
+        }
+        deflateSetDictionary(&ctx->strm, dict, dict_len);
+    }
+    return def_run(&ctx->strm, dest, dest_len, source, source_len, last ? Z_FINISH : Z_SYNC_FLUSH);
+}
+
+/**
+ * @brief: write the two byte zlib header of a stream deflated at level with
+ *         a 32K window and no preset dictionary, as deflateInit would
+ * @param: dest U8* two bytes of output
+ * @param: level int compression level as for mem_def
+ */
+void mem_def_header(U8 *dest, int level)
+{
+    int lvl = level == Z_DEFAULT_COMPRESSION ? 6 : level;
+    unsigned flags = lvl < 2 ? 0 : lvl < 6 ? 1 : lvl == 6 ? 2 : 3;
+    unsigned header = (Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8 | flags << 6;
+    header += 31 - header % 31;
+    dest[0] = header >> 8;
+    dest[1] = header & 0xff;
 }
 
 /**
- * @brief: inflate in memory data from source to dest 
+ * @brief: inflate in memory data from source to dest
  * @param: dest U8* output buffer, caller supplies, should be big enough
- *         to hold the deflated data
- * @param: dest_len, U64* output parameter, length of inflated data
+ *         to hold the inflated data
+ * @param: dest_len, U64* in: capacity of dest, out: length of inflated data
  * @param: source U8* source buffer, contains zlib data to be inflated
  * @param: source_len U64 length of source data
- * 
+ *
  * @return =0  on success
- *         <>0 error
+ *         <>0 error, Z_BUF_ERROR when dest is too small
+ * NOTE: each call sets up and frees a zlib stream, mem_inf_ctx reuses one
  */
 int mem_inf(U8 *dest, U64 *dest_len, U8 *source,  U64 source_len)
 {
-    z_stream strm;    /* pass info. to and from zlib routines   */
-    U8 out[CHUNK];    /* output buffer for inflate()            */
-    int ret = 0;      /* zlib return code                       */
-    int have = 0;     /* amount of data returned from inflate() */
-    int inf_len = 0;  /* accumulated inflated data length       */
-    U8 *p_dest = dest;/* first empty slot in dest buffer        */
-
-    /* allocate inflate state 8 */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = 0;        /* no input data being provided   */
-    strm.next_in = Z_NULL;    /* no input data being provided   */
-    ret = inflateInit(&strm);
+    mem_ctx_t ctx;
+    int ret = mem_inf_init(&ctx, 0);
     if (ret != Z_OK) {
         return ret;
     }
-
-    /* set input data stream */
-    strm.avail_in = source_len;
-    strm.next_in = source;
-
-    /* run inflate() on input until output buffer not full */
-    do {
-        strm.avail_out = CHUNK;
-        strm.next_out = out;
-
-        /* zlib format is self-terminating, no need to flush */
-        ret = inflate(&strm, Z_NO_FLUSH);
-        assert(ret != Z_STREAM_ERROR);    /* state no t clobbered */
-        switch(ret) {
-        case Z_NEED_DICT:
-            ret = Z_DATA_ERROR;  /* and fall through */
-        case Z_DATA_ERROR:
-        case Z_MEM_ERROR:
-            (void) inflateEnd(&strm);
-			return ret;
-        }
-        have = CHUNK - strm.avail_out;
-        memcpy(p_dest, out, have);
-        p_dest += have;  /* advance to the next free byte to write */
-        inf_len += have; /* increment inflated data length         */
-    } while (strm.avail_out == 0 );
-
-    /* clean up and return */
-    (void) inflateEnd(&strm);
-    *dest_len = inf_len;
-    
-    return (ret == Z_STREAM_END) ? Z_OK : Z_DATA_ERROR;
+    ret = inf_run(&ctx.strm, dest, dest_len, source, source_len);
+    mem_ctx_end(&ctx);
+    return ret;
 }
 
 /* report a zlib or i/o error */